@@ -0,0 +1,441 @@
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct blob_t {
+  uint32_t offset;
+  uint64_t data_hash;
+  uint8_t* data;
+  uint32_t size;
+  uint32_t packed_size;
+  int dup_of;
+} blob_t;
+
+uint8_t* read_file(const char* path, uint32_t* size) {
+  FILE* f = fopen(path, "rb");
+
+  if (f == NULL) {
+    return NULL;
+  }
+
+  fseek(f, 0, SEEK_END);
+  *size = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  uint8_t* data = (uint8_t*)malloc((*size == 0) ? 1 : *size);
+
+  if (data == NULL || fread(data, 1, *size, f) != *size) {
+    free(data);
+    fclose(f);
+    return NULL;
+  }
+
+  fclose(f);
+  return data;
+}
+
+int write_file(const char* path, const uint8_t* data, uint32_t size) {
+  FILE* w = fopen(path, "wb");
+
+  if (w == NULL) {
+    return -1;
+  }
+
+  fwrite(data, 1, size, w);
+  fclose(w);
+  return 0;
+}
+
+static int load_offsets(const char* path, uint32_t** offsets) {
+  FILE* f = fopen(path, "r");
+
+  if (f == NULL) {
+    return -1;
+  }
+
+  int count = 0;
+  int capacity = 0;
+  char line[256];
+
+  *offsets = NULL;
+
+  while (fgets(line, sizeof(line), f) != NULL) {
+    char* end = NULL;
+    uint32_t offset = (uint32_t)strtoul(line, &end, 16);
+
+    if (end == line || (*end != '\0' && *end != '\r' && *end != '\n' && *end != ' ' && *end != '\t')) {
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity = (capacity == 0) ? 64 : (capacity * 2);
+      uint32_t* grown = (uint32_t*)realloc(*offsets, capacity * sizeof(uint32_t));
+
+      if (grown == NULL) {
+        free(*offsets);
+        fclose(f);
+        return -1;
+      }
+
+      *offsets = grown;
+    }
+
+    (*offsets)[count++] = offset;
+  }
+
+  fclose(f);
+  return count;
+}
+
+static int longest_shared_prefix(const blob_t* blobs, int index, uint32_t* shared) {
+  int best = -1;
+  *shared = 0;
+
+  for (int i = 0; i < index; ++i) {
+    if (blobs[i].dup_of >= 0) {
+      continue;
+    }
+
+    uint32_t n = (blobs[i].size < blobs[index].size) ? blobs[i].size : blobs[index].size;
+    uint32_t len = 0;
+
+    while (len < n && blobs[i].data[len] == blobs[index].data[len]) {
+      ++len;
+    }
+
+    if (len > *shared) {
+      *shared = len;
+      best = i;
+    }
+  }
+
+  return best;
+}
+
+static int find_duplicate(const blob_t* blobs, int index) {
+  for (int i = 0; i < index; ++i) {
+    if (blobs[i].dup_of >= 0 || blobs[i].data_hash != blobs[index].data_hash || blobs[i].size != blobs[index].size) {
+      continue;
+    }
+
+    if (memcmp(blobs[i].data, blobs[index].data, blobs[index].size) == 0) {
+      return i;
+    }
+  }
+
+  return -1;
+}
+
+static void report_shared_prefix(const blob_t* blobs, int index) {
+  uint32_t shared = 0;
+  int other = longest_shared_prefix(blobs, index, &shared);
+
+  if (other >= 0 && shared >= 0x100) {
+    printf("  0x%06X: shares 0x%X-byte prefix with 0x%06X\n", blobs[index].offset, shared, blobs[other].offset);
+  }
+}
+
+static void free_blobs(blob_t* blobs, int count) {
+  for (int i = 0; i < count; ++i) {
+    if (blobs[i].dup_of < 0) {
+      free(blobs[i].data);
+    }
+  }
+
+  free(blobs);
+}
+
+int batch_unpack(const char* rom_path, const char* out_dir, const char* list_path) {
+  uint32_t rom_size = 0;
+  uint8_t* rom = read_file(rom_path, &rom_size);
+
+  if (rom == NULL) {
+    printf("Cannot read source file!\n");
+    return -1;
+  }
+
+  uint32_t* offsets = NULL;
+  int count = load_offsets(list_path, &offsets);
+
+  if (count <= 0) {
+    free(rom);
+    printf("Cannot read offsets list!\n");
+    return -1;
+  }
+
+  blob_t* blobs = (blob_t*)calloc(count, sizeof(blob_t));
+
+  if (blobs == NULL) {
+    free(offsets);
+    free(rom);
+    printf("Cannot allocate batch memory!\n");
+    return -1;
+  }
+
+  int result = 0;
+  int unique = 0;
+
+  for (int i = 0; i < count; ++i) {
+    blob_t* b = &blobs[i];
+    b->offset = offsets[i];
+    b->dup_of = -1;
+
+    if (b->offset + 16 > rom_size) {
+      printf("  0x%06X: out of source file bounds\n", b->offset);
+      result = -1;
+      break;
+    }
+
+    const uint8_t* src = rom + b->offset;
+    uint32_t src_cap = rom_size - b->offset;
+
+    for (int j = 0; j < i; ++j) {
+      if (blobs[j].dup_of < 0 && blobs[j].packed_size <= src_cap && memcmp(rom + blobs[j].offset, src, blobs[j].packed_size) == 0) {
+        b->dup_of = j;
+        break;
+      }
+    }
+
+    if (b->dup_of >= 0) {
+      b->data = blobs[b->dup_of].data;
+      b->size = blobs[b->dup_of].size;
+      b->packed_size = blobs[b->dup_of].packed_size;
+      b->data_hash = blobs[b->dup_of].data_hash;
+      printf("  0x%06X: same packed data as 0x%06X, not decoded again\n", b->offset, blobs[b->dup_of].offset);
+    }
+    else {
+      b->size = get_decompressed_size(src);
+      b->data = (uint8_t*)malloc(b->size + decompress_slack);
+
+      if (b->data == NULL) {
+        printf("Cannot allocate destination data memory!\n");
+        result = -1;
+        break;
+      }
+
+      int size = decompress_safe(src, src_cap, b->data, b->size + decompress_slack, &b->packed_size);
+
+      if (size < 0 || (uint32_t)size != b->size) {
+        printf("  0x%06X: wrong compressed data (status %d)\n", b->offset, size);
+        result = -1;
+        break;
+      }
+
+      b->data_hash = hash_data(b->data, b->size);
+
+      int same = find_duplicate(blobs, i);
+
+      if (same >= 0) {
+        printf("  0x%06X: same unpacked data as 0x%06X\n", b->offset, blobs[same].offset);
+      }
+      else {
+        report_shared_prefix(blobs, i);
+      }
+
+      ++unique;
+    }
+
+    char path[1024];
+    snprintf(path, sizeof(path), "%s/%06X.bin", out_dir, b->offset);
+
+    if (write_file(path, b->data, b->size) != 0) {
+      printf("Cannot open destination file: %s\n", path);
+      result = -1;
+      break;
+    }
+  }
+
+  if (result == 0) {
+    printf("Unpacked %d blobs, %d decoded\n", count, unique);
+  }
+
+  free_blobs(blobs, count);
+  free(offsets);
+  free(rom);
+  return result;
+}
+
+int batch_repack(const char* in_dir, const char* out_dir, const char* list_path) {
+  uint32_t* offsets = NULL;
+  int count = load_offsets(list_path, &offsets);
+
+  if (count <= 0) {
+    printf("Cannot read offsets list!\n");
+    return -1;
+  }
+
+  blob_t* blobs = (blob_t*)calloc(count, sizeof(blob_t));
+
+  if (blobs == NULL) {
+    free(offsets);
+    printf("Cannot allocate batch memory!\n");
+    return -1;
+  }
+
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/manifest.txt", out_dir);
+
+  FILE* manifest = fopen(path, "w");
+
+  if (manifest == NULL) {
+    free(blobs);
+    free(offsets);
+    printf("Cannot open destination file: %s\n", path);
+    return -1;
+  }
+
+  int result = 0;
+  uint32_t reclaimed = 0;
+
+  for (int i = 0; i < count; ++i) {
+    blob_t* b = &blobs[i];
+    b->offset = offsets[i];
+    b->dup_of = -1;
+
+    snprintf(path, sizeof(path), "%s/%06X.bin", in_dir, b->offset);
+    b->data = read_file(path, &b->size);
+
+    if (b->data == NULL) {
+      printf("Cannot read source file: %s\n", path);
+      result = -1;
+      break;
+    }
+
+    b->data_hash = hash_data(b->data, b->size);
+
+    int same = find_duplicate(blobs, i);
+
+    if (same >= 0) {
+      free(b->data);
+      b->data = blobs[same].data;
+      b->packed_size = blobs[same].packed_size;
+      b->dup_of = same;
+      reclaimed += b->packed_size;
+
+      printf("  0x%06X: same data as 0x%06X, reuses its packed bytes\n", b->offset, blobs[same].offset);
+      fprintf(manifest, "%06X = %06X\n", b->offset, blobs[same].offset);
+      continue;
+    }
+
+    report_shared_prefix(blobs, i);
+
+    uint8_t* packed = (uint8_t*)malloc(max_compressed_size(b->size));
+
+    if (packed == NULL) {
+      printf("Cannot allocate destination data memory!\n");
+      result = -1;
+      break;
+    }
+
+    int packed_size = compress_with_parse(b->data, b->size, packed, NULL);
+
+    if (packed_size < 0) {
+      free(packed);
+      printf("  0x%06X: cannot compress source data\n", b->offset);
+      result = -1;
+      break;
+    }
+
+    b->packed_size = (uint32_t)packed_size;
+
+    snprintf(path, sizeof(path), "%s/%06X.cmp", out_dir, b->offset);
+
+    if (write_file(path, packed, b->packed_size) != 0) {
+      free(packed);
+      printf("Cannot open destination file: %s\n", path);
+      result = -1;
+      break;
+    }
+
+    free(packed);
+    fprintf(manifest, "%06X %06X.cmp %X\n", b->offset, b->offset, b->packed_size);
+  }
+
+  fclose(manifest);
+
+  if (result == 0) {
+    printf("Repacked %d blobs, 0x%X bytes reclaimed by duplicates\n", count, reclaimed);
+  }
+
+  free_blobs(blobs, count);
+  free(offsets);
+  return result;
+}
+
+int batch_decode_time(const char* rom_path, const char* list_path) {
+  uint32_t rom_size = 0;
+  uint8_t* rom = read_file(rom_path, &rom_size);
+
+  if (rom == NULL) {
+    printf("Cannot read source file!\n");
+    return -1;
+  }
+
+  uint32_t* offsets = NULL;
+  int count = load_offsets(list_path, &offsets);
+
+  if (count <= 0) {
+    free(rom);
+    printf("Cannot read offsets list!\n");
+    return -1;
+  }
+
+  int result = 0;
+  uint64_t total = 0;
+  uint64_t worst = 0;
+  uint32_t worst_offset = 0;
+
+  for (int i = 0; i < count; ++i) {
+    uint32_t offset = offsets[i];
+
+    if (offset + 16 > rom_size) {
+      printf("  0x%06X: out of source file bounds\n", offset);
+      result = -1;
+      break;
+    }
+
+    const uint8_t* src = rom + offset;
+    uint32_t size = get_decompressed_size(src);
+    uint8_t* data = (uint8_t*)malloc(size + decompress_slack);
+
+    if (data == NULL) {
+      printf("Cannot allocate destination data memory!\n");
+      result = -1;
+      break;
+    }
+
+    uint32_t packed_size = 0;
+    int r = decompress_safe(src, rom_size - offset, data, size + decompress_slack, &packed_size);
+    free(data);
+
+    decode_profile_t profile;
+
+    if (r < 0 || profile_decompress(src, &profile) != 0) {
+      printf("  0x%06X: wrong compressed data (status %d)\n", offset, r);
+      result = -1;
+      break;
+    }
+
+    printf("  0x%06X: 0x%X -> 0x%X bytes, ~%llu cycles (%.2f ms)\n", offset, profile.packed_size, profile.out_size,
+      (unsigned long long)profile.cycles, profile.cycles * 1000.0 / m68k_clock_hz);
+
+    total += profile.cycles;
+
+    if (profile.cycles > worst) {
+      worst = profile.cycles;
+      worst_offset = offset;
+    }
+  }
+
+  if (result == 0) {
+    printf("Total for %d blobs: ~%llu cycles (%.2f ms, %.2f frames at 60 Hz)\n", count, (unsigned long long)total,
+      total * 1000.0 / m68k_clock_hz, total * 60.0 / m68k_clock_hz);
+    printf("Slowest: 0x%06X, ~%llu cycles (%.2f ms)\n", worst_offset, (unsigned long long)worst, worst * 1000.0 / m68k_clock_hz);
+  }
+
+  free(offsets);
+  free(rom);
+  return result;
+}
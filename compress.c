@@ -1,8 +1,18 @@
 #include "main.h"
 
+#include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
 static void write_byte(uint8_t* dst, int* offset, uint8_t value) {
   dst[*offset] = value;
   *offset += 1;
@@ -21,27 +31,58 @@ static void write_dword_be(uint8_t* dst, int* offset, uint32_t value) {
 typedef struct bitwriter_t {
   uint8_t* dst;
   int* woff;
+  FILE* spool;
   uint32_t token;
   int bits_used;
   int token_pos;
+  uint32_t tokens;
 } bitwriter_t;
 
 static void bw_init(bitwriter_t* bw, uint8_t* dst, int* woff) {
   bw->dst = dst;
   bw->woff = woff;
+  bw->spool = NULL;
   bw->token = 0;
   bw->bits_used = 0;
   bw->token_pos = *woff;
+  bw->tokens = 0;
   write_dword_be(dst, woff, 0);
 }
 
+static void bw_init_spool(bitwriter_t* bw, FILE* spool) {
+  bw->dst = NULL;
+  bw->woff = NULL;
+  bw->spool = spool;
+  bw->token = 0;
+  bw->bits_used = 0;
+  bw->token_pos = 0;
+  bw->tokens = 0;
+}
+
+static void bw_store_token(bitwriter_t* bw) {
+  if (bw->spool != NULL) {
+    uint8_t buf[4];
+    int tmp = 0;
+    write_dword_be(buf, &tmp, bw->token);
+    fwrite(buf, 1, sizeof(buf), bw->spool);
+  }
+  else {
+    int tmp = bw->token_pos;
+    write_dword_be(bw->dst, &tmp, bw->token);
+  }
+
+  bw->tokens += 1;
+}
+
 static void bw_flush_token(bitwriter_t* bw) {
-  int tmp = bw->token_pos;
-  write_dword_be(bw->dst, &tmp, bw->token);
+  bw_store_token(bw);
   bw->token = 0;
   bw->bits_used = 0;
-  bw->token_pos = *bw->woff;
-  write_dword_be(bw->dst, bw->woff, 0);
+
+  if (bw->spool == NULL) {
+    bw->token_pos = *bw->woff;
+    write_dword_be(bw->dst, bw->woff, 0);
+  }
 }
 
 static void bw_putbit(bitwriter_t* bw, int bit) {
@@ -63,8 +104,7 @@ static void bw_putbits(bitwriter_t* bw, uint32_t value, int count) {
 }
 
 static void bw_finish(bitwriter_t* bw) {
-  int tmp = bw->token_pos;
-  write_dword_be(bw->dst, &tmp, bw->token);
+  bw_store_token(bw);
 }
 
 static void write_count(bitwriter_t* bw, uint32_t zeros_before_one) {
@@ -174,8 +214,20 @@ static int token_bit_cost(uint16_t max_value, uint16_t x) {
   return -1;
 }
 
+static uint16_t unp_limit(int unp_count) {
+  if (unp_count < 0) {
+    return 0u;
+  }
+
+  if (unp_count > 0xFFFF) {
+    return 0xFFFFu;
+  }
+
+  return (uint16_t)unp_count;
+}
+
 static int pair_bit_cost(uint16_t max_from, uint16_t max_count, int word_mode, int unp_count, uint16_t from, uint16_t len) {
-  uint16_t up = (unp_count < 0) ? 0u : (uint16_t)unp_count;
+  uint16_t up = unp_limit(unp_count);
 
   uint16_t token_val_from = max_from;
   if (token_val_from > up) {
@@ -213,9 +265,234 @@ static int pair_bit_cost(uint16_t max_from, uint16_t max_count, int word_mode, i
   return c1 + c2;
 }
 
-static match_t find_best_match_cost(const uint8_t* in, uint32_t pos, uint32_t total_elems, uint16_t max_from, uint16_t max_count, int word_mode, int unp_count) {
+static uint32_t find_period(const uint8_t* in, uint32_t pos, uint32_t total_elems, int word_mode, uint32_t lowest, uint32_t* run_start, uint32_t* run_end) {
+  uint32_t stride = (word_mode != 0) ? 2u : 1u;
+  uint32_t limit = (total_elems - pos > 0xFFFFu) ? (pos + 0xFFFFu) : total_elems;
+  uint32_t period = 0u;
+  uint32_t end = pos;
+
+  for (uint32_t p = 1u; p <= 4u && p <= pos; ++p) {
+    uint32_t e = pos;
+
+    while (e < limit && elements_equal(in + e * stride, in + (e - p) * stride, word_mode)) {
+      ++e;
+    }
+
+    if (e > end) {
+      end = e;
+      period = p;
+    }
+  }
+
+  if (period == 0u || end - pos < 16u) {
+    return 0u;
+  }
+
+  uint32_t start = pos;
+
+  while (start > lowest + period && elements_equal(in + (start - 1u) * stride, in + (start - 1u - period) * stride, word_mode)) {
+    --start;
+  }
+
+  *run_start = start;
+  *run_end = end;
+  return period;
+}
+
+static void score_match(uint16_t max_from, uint16_t max_count, int word_mode, int unp_count, uint32_t from, uint32_t len, match_t* best, double* best_score) {
+  int bits = pair_bit_cost(max_from, max_count, word_mode, unp_count, (uint16_t)from, (uint16_t)len);
+
+  if (bits < 0) {
+    return;
+  }
+
+  double score = (double)bits / (double)len;
+  if (score < *best_score || (score == *best_score && len > (uint32_t)best->len)) {
+    *best_score = score;
+    best->from = (uint16_t)from;
+    best->len = (uint16_t)len;
+  }
+}
+
+static void score_run_candidates(uint16_t max_from, uint16_t max_count, int word_mode, int unp_count, uint32_t pos, uint32_t period, uint32_t run_start, uint32_t run_end, uint32_t max_from_u, match_t* best, double* best_score) {
+  uint32_t base = (word_mode != 0) ? 1u : 2u;
+  uint32_t extra = (word_mode != 0) ? 0u : 1u;
+
+  if (run_start - period > pos - base) {
+    return;
+  }
+
+  uint32_t top = table[sizeof(table) / sizeof(table[0]) - 1].items[0].w0;
+  uint32_t lo = (period - (base % period)) % period;
+  uint32_t hi = pos - base - (run_start - period);
+
+  if (hi > max_from_u) {
+    hi = max_from_u;
+  }
+
+  if (hi > top) {
+    hi = top;
+  }
+
+  uint32_t drop = (hi + base) % period;
+
+  if (hi < drop) {
+    return;
+  }
+
+  hi -= drop;
+
+  uint32_t run_len = (run_end - pos < top + 1u + extra) ? (run_end - pos) : (top + 1u + extra);
+  uint32_t need = (run_len > 1u + extra) ? (run_len - 1u - extra) : 0u;
+
+  if (need < lo) {
+    need = lo;
+  }
+
+  need += (period - (need + base) % period) % period;
+
+  if (need > hi) {
+    need = hi;
+  }
+
+  uint32_t froms[2] = { need, hi };
+
+  for (int i = 0; i < 2; ++i) {
+    uint32_t cnt = (froms[i] < max_count) ? froms[i] : max_count;
+    uint32_t len = (cnt + 1u + extra < run_len) ? (cnt + 1u + extra) : run_len;
+    score_match(max_from, max_count, word_mode, unp_count, froms[i], len, best, best_score);
+  }
+}
+
+typedef struct match_chain_t {
+  uint32_t depth;
+  uint32_t* prev;
+} match_chain_t;
+
+static const uint32_t chain_hash_size = 1u << 16;
+static const uint32_t chain_no_pos = 0xFFFFFFFFu;
+
+static uint32_t chain_hash(const uint8_t* in, uint32_t pos, int word_mode) {
+  const uint8_t* p = in + pos * ((word_mode != 0) ? 2u : 1u);
+  uint32_t h = (uint32_t)p[0] * 0x9E3779B1u;
+  h ^= (uint32_t)p[1] * 0x85EBCA6Bu;
+  h ^= (uint32_t)p[2] * 0xC2B2AE35u;
+
+  if (word_mode != 0) {
+    h ^= (uint32_t)p[3] * 0x27D4EB2Fu;
+  }
+
+  return h >> 16;
+}
+
+static int init_match_chain(const uint8_t* in, uint32_t total_elems, int word_mode, uint32_t depth, match_chain_t* chain) {
+  uint32_t need = (word_mode != 0) ? 2u : 3u;
+  uint32_t* head = (uint32_t*)malloc(chain_hash_size * sizeof(uint32_t));
+
+  chain->depth = depth;
+  chain->prev = (uint32_t*)malloc(((total_elems == 0u) ? 1u : total_elems) * sizeof(uint32_t));
+
+  if (head == NULL || chain->prev == NULL) {
+    free(chain->prev);
+    free(head);
+    return -1;
+  }
+
+  for (uint32_t i = 0u; i < chain_hash_size; ++i) {
+    head[i] = chain_no_pos;
+  }
+
+  for (uint32_t i = 0u; i < total_elems; ++i) {
+    if (i + need > total_elems) {
+      chain->prev[i] = chain_no_pos;
+      continue;
+    }
+
+    uint32_t h = chain_hash(in, i, word_mode);
+    chain->prev[i] = head[h];
+    head[h] = i;
+  }
+
+  free(head);
+  return 0;
+}
+
+static void free_match_chain(match_chain_t* chain) {
+  free(chain->prev);
+  chain->prev = NULL;
+}
+
+static match_t find_chain_match(const uint8_t* in, uint32_t pos, uint32_t total_elems, uint16_t max_from, uint16_t max_count, int word_mode, int unp_count, const match_chain_t* chain) {
+  match_t best = { 0, 0 };
+
+  uint32_t stride = (word_mode != 0) ? 2u : 1u;
+  uint32_t base = (word_mode != 0) ? 1u : 2u;
+  uint32_t extra = (word_mode != 0) ? 0u : 1u;
+
+  if (pos < base) {
+    return best;
+  }
+
+  uint32_t max_from_u = unp_limit(unp_count);
+
+  if (max_from_u > max_from) {
+    max_from_u = max_from;
+  }
+
+  if (max_from_u > pos - base) {
+    max_from_u = pos - base;
+  }
+
+  double best_score = 1e100;
+  uint32_t cand = chain->prev[pos];
+
+  for (uint32_t depth = 0u; cand != chain_no_pos && depth < chain->depth; ++depth, cand = chain->prev[cand]) {
+    if (cand + base > pos) {
+      continue;
+    }
+
+    uint32_t from = pos - base - cand;
+
+    if (from > max_from_u) {
+      break;
+    }
+
+    uint32_t maxlen = ((from < max_count) ? from : max_count) + 1u + extra;
+
+    if (maxlen > 0xFFFFu) {
+      maxlen = 0xFFFFu;
+    }
+
+    if (maxlen > total_elems - pos) {
+      maxlen = total_elems - pos;
+    }
+
+    uint32_t len = 0u;
+    while (len < maxlen && elements_equal(in + (pos + len) * stride, in + (cand + len) * stride, word_mode)) {
+      ++len;
+    }
+
+    score_match(max_from, max_count, word_mode, unp_count, from, len, &best, &best_score);
+  }
+
+  uint32_t run_start = pos;
+  uint32_t run_end = pos;
+  uint32_t period = find_period(in, pos, total_elems, word_mode, pos - base - max_from_u, &run_start, &run_end);
+
+  if (period != 0u) {
+    score_run_candidates(max_from, max_count, word_mode, unp_count, pos, period, run_start, run_end, max_from_u, &best, &best_score);
+  }
+
+  return best;
+}
+
+static match_t find_best_match_cost(const uint8_t* in, uint32_t pos, uint32_t total_elems, uint16_t max_from, uint16_t max_count, int word_mode, int unp_count, const match_chain_t* chain) {
   match_t best = { 0, 0 };
 
+  if (chain != NULL) {
+    return find_chain_match(in, pos, total_elems, max_from, max_count, word_mode, unp_count, chain);
+  }
+
   uint32_t stride = (word_mode != 0) ? 2u : 1u;
   uint32_t base = (word_mode != 0) ? 1u : 2u;
   uint32_t minlen = (word_mode != 0) ? 1u : 2u;
@@ -224,7 +501,7 @@ static match_t find_best_match_cost(const uint8_t* in, uint32_t pos, uint32_t to
     return best;
   }
 
-  uint16_t up = (unp_count < 0) ? 0u : (uint16_t)unp_count;
+  uint16_t up = unp_limit(unp_count);
   uint16_t token_val_from = max_from;
 
   if (token_val_from > up) {
@@ -238,6 +515,17 @@ static match_t find_best_match_cost(const uint8_t* in, uint32_t pos, uint32_t to
     max_from_u = lim;
   }
 
+  uint32_t run_start = pos;
+  uint32_t run_end = pos;
+  uint32_t period = find_period(in, pos, total_elems, word_mode, pos - base - max_from_u, &run_start, &run_end);
+  uint32_t periodic_froms = 0u;
+  uint32_t next_periodic = 0xFFFFFFFFu;
+
+  if (period != 0u) {
+    periodic_froms = pos - base - run_start + period + 1u;
+    next_periodic = (period - (base % period)) % period;
+  }
+
   double best_score = 1e100;
 
   for (uint32_t from = 0u; from <= max_from_u; ++from) {
@@ -251,12 +539,31 @@ static match_t find_best_match_cost(const uint8_t* in, uint32_t pos, uint32_t to
 
     uint32_t extra = (word_mode != 0) ? 0u : 1u;
     uint32_t maxlen = (uint32_t)token_val_cnt + 1u + extra;
-    
+
+    if (maxlen > 0xFFFFu) {
+      maxlen = 0xFFFFu;
+    }
+
     if (maxlen > (total_elems - pos)) {
       maxlen = (total_elems - pos);
     }
 
     uint32_t len = 0u;
+
+    if (from == next_periodic) {
+      len = run_end - pos;
+
+      if (len > maxlen) {
+        len = maxlen;
+      }
+
+      next_periodic += period;
+
+      if (next_periodic >= periodic_froms) {
+        next_periodic = 0xFFFFFFFFu;
+      }
+    }
+
     while (len < maxlen) {
       const uint8_t* p1 = in + (pos + len) * stride;
       const uint8_t* p2 = in + (src_pos + len) * stride;
@@ -295,151 +602,180 @@ static match_t find_best_match_cost(const uint8_t* in, uint32_t pos, uint32_t to
   return best;
 }
 
-static int has_any_valid_pair(const uint8_t* src, uint32_t pos, uint32_t total_elems, uint16_t max_from, uint16_t max_count, int word_mode, int unp_count_at_pos) {
-  match_t m = find_best_match_cost(src, pos, total_elems, max_from, max_count, word_mode, unp_count_at_pos);
+static int has_any_valid_pair(const uint8_t* src, uint32_t pos, uint32_t total_elems, uint16_t max_from, uint16_t max_count, int word_mode, int unp_count_at_pos, const match_chain_t* chain) {
+  match_t m = find_best_match_cost(src, pos, total_elems, max_from, max_count, word_mode, unp_count_at_pos, chain);
   return (m.len != 0u);
 }
 
-static int compress_full(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint16_t max_from, uint16_t max_count, int prefer_word_mode) {
-  if (src == NULL || dst == NULL) {
-    return -1;
-  }
+static int parse_push(parse_t* parse, uint8_t is_pair, uint16_t from, uint32_t len) {
+  if (parse->count == parse->capacity) {
+    uint32_t capacity = (parse->capacity == 0u) ? 256u : (parse->capacity * 2u);
+    parse_token_t* tokens = (parse_token_t*)realloc(parse->tokens, capacity * sizeof(parse_token_t));
 
-  int word_mode = 0;
+    if (tokens == NULL) {
+      return -1;
+    }
 
-  if (prefer_word_mode != 0 && (src_size % 2u) == 0u) {
-    word_mode = 1;
+    parse->tokens = tokens;
+    parse->capacity = capacity;
   }
 
-  uint32_t stride = (word_mode != 0) ? 2u : 1u;
-  uint32_t total_elems = (word_mode != 0) ? (src_size / 2u) : src_size;
-
-  int woff = 0;
-
-  uint32_t left_field = (word_mode != 0) ? (total_elems << 1) : total_elems;
-  write_dword_be(dst, &woff, left_field);
+  parse_token_t* t = &parse->tokens[parse->count++];
+  t->is_pair = is_pair;
+  t->from = from;
+  t->len = len;
+  return 0;
+}
 
-  int data_off_field_pos = woff;
-  write_dword_be(dst, &woff, 0);
+static int parse_group(const uint8_t* src, uint32_t total_elems, uint16_t max_from, uint16_t max_count, int word_mode, uint32_t pos, const match_chain_t* chain, parse_t* parse, uint32_t* out_pos) {
+  uint32_t start_pos = pos;
+  int start_unp = (int)pos - 1 - ((word_mode != 0) ? 0 : 1);
 
-  write_word_be(dst, &woff, max_from);
-  write_word_be(dst, &woff, max_count);
+  uint32_t lit_len = 1u;
 
-  bitwriter_t bw;
-  bw_init(&bw, dst, &woff);
+  if (start_pos == 0u) {
+    lit_len = (word_mode != 0) ? 1u : 2u;
 
+    if (lit_len > (total_elems - start_pos)) {
+      lit_len = (total_elems - start_pos);
+    }
+  }
 
-  bw_putbit(&bw, (word_mode != 0) ? 1 : 0);
+  while (start_pos + lit_len < total_elems) {
+    uint32_t after = start_pos + lit_len;
+    int unp_after = start_unp + (int)lit_len;
 
-  uint8_t* lit = (uint8_t*)malloc((src_size == 0u) ? 1u : src_size);
+    if (lit_len == 0xFFFFu || has_any_valid_pair(src, after, total_elems, max_from, max_count, word_mode, unp_after, chain)) {
+      break;
+    }
+    ++lit_len;
+  }
 
-  if (lit == NULL) {
+  if (lit_len == 0u) {
     return -1;
   }
-  uint32_t lit_size = 0u;
 
-  int unp_count = -1 - ((word_mode != 0) ? 0 : 1);
+  if (parse_push(parse, 0, 0, lit_len) != 0) {
+    return -1;
+  }
 
-  uint32_t pos = 0u;
-  while (pos < total_elems) {
-    uint32_t start_pos = pos;
-    int start_unp = unp_count;
+  pos = start_pos + lit_len;
+  int unp_count = start_unp + (int)lit_len;
 
-    uint32_t lit_len = 1u;
+  if (pos >= total_elems) {
+    *out_pos = pos;
+    return 0;
+  }
 
-    if (start_pos == 0u) {
-      lit_len = (word_mode != 0) ? 1u : 2u;
+  uint32_t npairs = 0u;
 
-      if (lit_len > (total_elems - start_pos)) {
-        lit_len = (total_elems - start_pos);
-      }
+  while (pos < total_elems && npairs < 256u) {
+    match_t m0 = find_best_match_cost(src, pos, total_elems, max_from, max_count, word_mode, unp_count, chain);
+    if (m0.len == 0u) {
+      break;
     }
 
-    while (start_pos + lit_len < total_elems) {
-      uint32_t after = start_pos + lit_len;
-      int unp_after = start_unp + (int)lit_len;
+    if (pos + 1u < total_elems) {
+      match_t m1 = find_best_match_cost(src, pos + 1u, total_elems, max_from, max_count, word_mode, unp_count + 1, chain);
 
-      if (has_any_valid_pair(src, after, total_elems, max_from, max_count, word_mode, unp_after)) {
-        break;
+      if (m1.len != 0u) {
+        int bits0 = pair_bit_cost(max_from, max_count, word_mode, unp_count, m0.from, m0.len);
+        int bits1 = pair_bit_cost(max_from, max_count, word_mode, unp_count + 1, m1.from, m1.len);
+
+        double r0 = (bits0 > 0) ? ((double)bits0 / (double)m0.len) : 1e100;
+        double r1 = (bits1 > 0) ? ((double)bits1 / (double)m1.len) : 1e100;
+
+        if (r1 + 0.02 < r0 && npairs > 0u) {
+          break;
+        }
       }
-      ++lit_len;
     }
 
-    if (lit_len == 0u) {
-      free(lit);
+    if (parse_push(parse, 1, m0.from, m0.len) != 0) {
       return -1;
     }
 
-    write_count(&bw, lit_len - 1u);
-
-    uint32_t bytes = lit_len * stride;
+    ++npairs;
+    pos += m0.len;
+    unp_count += (int)m0.len;
 
-    if (lit_size + bytes > src_size) {
-      free(lit);
-      return -1;
+    if (pos >= total_elems) {
+      break;
     }
+  }
 
-    memcpy(lit + lit_size, src + start_pos * stride, bytes);
-    lit_size += bytes;
+  if (npairs == 0u) {
+    return -1;
+  }
 
-    pos = start_pos + lit_len;
-    unp_count = start_unp + (int)lit_len;
+  *out_pos = pos;
+  return 0;
+}
 
-    if (pos >= total_elems) {
-      break;
-    }
+static int emit_parse(const uint8_t* src, const parse_t* parse, uint8_t* dst) {
+  int word_mode = parse->word_mode;
+  uint32_t stride = (word_mode != 0) ? 2u : 1u;
+  uint32_t total_elems = parse->total_elems;
+  uint16_t max_from = parse->max_from;
+  uint16_t max_count = parse->max_count;
+  uint16_t extra = (word_mode != 0) ? 0u : 1u;
 
-    match_t pairs[256];
-    uint32_t npairs = 0u;
+  int woff = 0;
 
-    while (pos < total_elems && npairs < 256u) {
-      match_t m0 = find_best_match_cost(src, pos, total_elems, max_from, max_count, word_mode, unp_count);
-      if (m0.len == 0u) {
-        break;
-      }
+  uint32_t left_field = (word_mode != 0) ? (total_elems << 1) : total_elems;
+  write_dword_be(dst, &woff, left_field);
 
-      if (pos + 1u < total_elems) {
-        match_t m1 = find_best_match_cost(src, pos + 1u, total_elems, max_from, max_count, word_mode, unp_count + 1);
+  int data_off_field_pos = woff;
+  write_dword_be(dst, &woff, 0);
 
-        if (m1.len != 0u) {
-          int bits0 = pair_bit_cost(max_from, max_count, word_mode, unp_count, m0.from, m0.len);
-          int bits1 = pair_bit_cost(max_from, max_count, word_mode, unp_count + 1, m1.from, m1.len);
+  write_word_be(dst, &woff, max_from);
+  write_word_be(dst, &woff, max_count);
 
-          double r0 = (bits0 > 0) ? ((double)bits0 / (double)m0.len) : 1e100;
-          double r1 = (bits1 > 0) ? ((double)bits1 / (double)m1.len) : 1e100;
+  bitwriter_t bw;
+  bw_init(&bw, dst, &woff);
 
-          if (r1 + 0.02 < r0 && npairs > 0u) {
-            break;
-          }
-        }
-      }
+  bw_putbit(&bw, (word_mode != 0) ? 1 : 0);
 
-      pairs[npairs++] = m0;
-      pos += m0.len;
-      unp_count += (int)m0.len;
+  int unp_count = -1 - ((word_mode != 0) ? 0 : 1);
 
-      if (pos >= total_elems) {
-        break;
-      }
+  uint32_t pos = 0u;
+  uint32_t i = 0u;
+  while (i < parse->count) {
+    uint32_t lit_len = 0u;
+
+    while (i < parse->count && parse->tokens[i].is_pair == 0) {
+      lit_len += parse->tokens[i].len;
+      ++i;
     }
 
-    if (npairs == 0u) {
-      free(lit);
+    if (lit_len == 0u || lit_len > 0xFFFFu) {
       return -1;
     }
 
-    write_count(&bw, npairs - 1u);
+    write_count(&bw, lit_len - 1u);
+
+    pos += lit_len;
+    unp_count += (int)lit_len;
+
+    if (pos >= total_elems) {
+      break;
+    }
 
-    int sum_len = 0;
+    uint32_t first = i;
 
-    for (uint32_t i = 0; i < npairs; ++i) {
-      sum_len += (int)pairs[i].len;
+    while (i < parse->count && parse->tokens[i].is_pair != 0) {
+      ++i;
     }
 
-    int unp_enc = unp_count - sum_len;
+    if (i == first) {
+      return -1;
+    }
 
-    for (uint32_t i = 0u; i < npairs; ++i) {
-      uint16_t up = (unp_enc < 0) ? 0u : (uint16_t)unp_enc;
+    write_count(&bw, i - first - 1u);
+
+    for (uint32_t k = first; k < i; ++k) {
+      const parse_token_t* t = &parse->tokens[k];
+      uint16_t up = unp_limit(unp_count);
 
       uint16_t token_val_from = max_from;
 
@@ -447,29 +783,35 @@ static int compress_full(const uint8_t* src, uint32_t src_size, uint8_t* dst, ui
         token_val_from = up;
       }
 
-      if (write_token(&bw, token_val_from, pairs[i].from) != 0) {
-        free(lit);
+      if (write_token(&bw, token_val_from, t->from) != 0) {
         return -1;
       }
 
       uint16_t token_val_cnt = max_count;
 
-      if (token_val_cnt > pairs[i].from) {
-        token_val_cnt = pairs[i].from;
+      if (token_val_cnt > t->from) {
+        token_val_cnt = t->from;
       }
 
-      uint16_t extra = (word_mode != 0) ? 0u : 1u;
-      uint16_t count_token = (uint16_t)(pairs[i].len - 1u - extra);
+      if (t->len < 1u + extra) {
+        return -1;
+      }
+
+      uint16_t count_token = (uint16_t)(t->len - 1u - extra);
 
       if (write_token(&bw, token_val_cnt, count_token) != 0) {
-        free(lit);
         return -1;
       }
 
-      unp_enc += (int)pairs[i].len;
+      pos += t->len;
+      unp_count += (int)t->len;
     }
   }
 
+  if (pos != total_elems || i != parse->count) {
+    return -1;
+  }
+
   bw_finish(&bw);
 
   uint32_t data_off = (uint32_t)woff;
@@ -478,15 +820,90 @@ static int compress_full(const uint8_t* src, uint32_t src_size, uint8_t* dst, ui
   int tmp = data_off_field_pos;
   write_dword_be(dst, &tmp, data_off_minus_8);
 
-  memcpy(dst + data_off, lit, lit_size);
-  woff += (int)lit_size;
+  pos = 0u;
+  for (i = 0u; i < parse->count; ++i) {
+    const parse_token_t* t = &parse->tokens[i];
+
+    if (t->is_pair == 0) {
+      memcpy(dst + woff, src + pos * stride, t->len * stride);
+      woff += (int)(t->len * stride);
+    }
+
+    pos += t->len;
+  }
 
-  free(lit);
   return woff;
 }
 
+static int compress_full(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint16_t max_from, uint16_t max_count, int prefer_word_mode, uint32_t budget, parse_t* out_parse) {
+  if (src == NULL || dst == NULL) {
+    return -1;
+  }
 
-typedef struct compress_choice_t {
+  int word_mode = 0;
+
+  if (prefer_word_mode != 0 && (src_size % 2u) == 0u) {
+    word_mode = 1;
+  }
+
+  uint32_t stride = (word_mode != 0) ? 2u : 1u;
+  uint32_t total_elems = (word_mode != 0) ? (src_size / 2u) : src_size;
+
+  parse_t parse;
+  init_parse(&parse, word_mode, max_from, max_count, total_elems);
+
+  uint64_t bits = 1u;
+  uint64_t lit_bytes = 0u;
+  uint32_t cost_pos = 0u;
+
+  uint32_t pos = 0u;
+  while (pos < total_elems) {
+    uint32_t first = parse.count;
+
+    if (parse_group(src, total_elems, max_from, max_count, word_mode, pos, NULL, &parse, &pos) != 0) {
+      free_parse(&parse);
+      return -1;
+    }
+
+    if (budget == 0xFFFFFFFFu) {
+      continue;
+    }
+
+    for (uint32_t i = first; i < parse.count; ++i) {
+      const parse_token_t* t = &parse.tokens[i];
+
+      if (t->is_pair == 0) {
+        bits += t->len;
+        lit_bytes += (uint64_t)t->len * stride;
+      }
+      else {
+        int unp_count = (int)cost_pos - 1 - ((word_mode != 0) ? 0 : 1);
+        bits += 1u + (uint32_t)pair_bit_cost(max_from, max_count, word_mode, unp_count, t->from, (uint16_t)t->len);
+      }
+
+      cost_pos += t->len;
+    }
+
+    if (12u + 4u * ((bits + 31u) / 32u) + lit_bytes > budget) {
+      free_parse(&parse);
+      return COMPRESS_ERR_OVER_BUDGET;
+    }
+  }
+
+  int size = emit_parse(src, &parse, dst);
+
+  if (out_parse != NULL && size >= 0) {
+    parse.src_hash = hash_data(src, src_size);
+    *out_parse = parse;
+  }
+  else {
+    free_parse(&parse);
+  }
+
+  return size;
+}
+
+typedef struct compress_choice_t {
   int word_mode;
   uint16_t max_from;
   uint16_t max_count;
@@ -513,68 +930,407 @@ static uint16_t clamp_u16(uint32_t v, uint16_t lo, uint16_t hi) {
   return (uint16_t)v;
 }
 
-static int choose_word_mode_by_size(const uint8_t* src, uint32_t src_size, uint8_t* tmp, uint16_t max_from, uint16_t max_count, int* out_word_mode) {
-  int best_mode = 0;
-  int best_size = -1;
+static int compress_trials(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint8_t* tmp, uint32_t budget, parse_t* parse) {
+  parse_t p0;
+  parse_t p1;
+
+  int s0 = compress_full(src, src_size, dst, 0xFFFF, 0xFFFF, 0, budget, (parse != NULL) ? &p0 : NULL);
+  int best = s0;
 
-  int s0 = compress_full(src, src_size, tmp, max_from, max_count, 0);
-  if (s0 >= 0) {
-    best_size = s0;
-    best_mode = 0;
+  if (s0 >= 0 && parse != NULL) {
+    *parse = p0;
   }
 
   if ((src_size % 2u) == 0u) {
-    int s1 = compress_full(src, src_size, tmp, max_from, max_count, 1);
+    uint32_t word_budget = budget;
+
+    if (s0 >= 0 && (uint32_t)s0 - 1u < word_budget) {
+      word_budget = (uint32_t)s0 - 1u;
+    }
+
+    int s1 = compress_full(src, src_size, tmp, 0xFFFF, 0xFFFF, 1, word_budget, (parse != NULL) ? &p1 : NULL);
+
     if (s1 >= 0) {
-      if (best_size < 0) {
-        best_size = s1;
-        best_mode = 1;
-      }
-      else {
-        if (s1 < best_size) {
-          best_size = s1;
-          best_mode = 1;
+      memcpy(dst, tmp, s1);
+      best = s1;
+
+      if (parse != NULL) {
+        if (s0 >= 0) {
+          free_parse(&p0);
         }
+        *parse = p1;
       }
     }
+    else if (s0 < 0) {
+      best = (s0 == COMPRESS_ERR_OVER_BUDGET || s1 == COMPRESS_ERR_OVER_BUDGET) ? COMPRESS_ERR_OVER_BUDGET : s1;
+    }
   }
 
-  if (best_size < 0) {
-    return -1;
-  }
-
-  *out_word_mode = best_mode;
-  return best_size;
+  return best;
 }
 
-int compress(const uint8_t* src, uint32_t src_size, uint8_t* dst) {
+int compress_with_budget(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t budget, parse_t* parse) {
   if (src == NULL || dst == NULL) {
-    return -1;
+    return COMPRESS_ERR_FAILED;
   }
 
   uint32_t tmp_cap = worst_case_bound(src_size);
   if (tmp_cap == 0xFFFFFFFFu) {
-    return 1;
+    return COMPRESS_ERR_FAILED;
   }
 
   uint8_t* tmp = (uint8_t*)malloc(tmp_cap);
   if (tmp == NULL) {
-    return 1;
+    return COMPRESS_ERR_FAILED;
   }
 
-  int mode = 0;
-  int size = choose_word_mode_by_size(src, src_size, tmp, 0xFFFF, 0xFFFF, &mode);
+  int final_size = compress_trials(src, src_size, dst, tmp, budget, parse);
+
+  free(tmp);
+
+  if (final_size == COMPRESS_ERR_OVER_BUDGET) {
+    return COMPRESS_ERR_OVER_BUDGET;
+  }
 
-  int final_size = compress_full(src, src_size, dst, 0xFFFF, 0xFFFF, mode);
   if (final_size < 0) {
-    free(tmp);
-    return 1;
+    return COMPRESS_ERR_FAILED;
   }
 
-  free(tmp);
   return final_size;
 }
 
+int compress_with_parse(const uint8_t* src, uint32_t src_size, uint8_t* dst, parse_t* parse) {
+  return compress_with_budget(src, src_size, dst, 0xFFFFFFFFu, parse);
+}
+
+int compress(const uint8_t* src, uint32_t src_size, uint8_t* dst) {
+  int size = compress_with_parse(src, src_size, dst, NULL);
+
+  return (size < 0) ? 1 : size;
+}
+
+static int find_token_start(const uint32_t* starts, uint32_t count, uint32_t pos) {
+  uint32_t lo = 0u;
+  uint32_t hi = count;
+
+  while (lo < hi) {
+    uint32_t mid = lo + (hi - lo) / 2u;
+
+    if (starts[mid] < pos) {
+      lo = mid + 1u;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  if (lo < count && starts[lo] == pos) {
+    return (int)lo;
+  }
+
+  return -1;
+}
+
+static int can_splice_tail(const parse_t* old_parse, uint32_t index, uint32_t pos, uint32_t change_end) {
+  int word_mode = old_parse->word_mode;
+  uint32_t base = (word_mode != 0) ? 1u : 2u;
+
+  for (uint32_t i = index; i < old_parse->count; ++i) {
+    const parse_token_t* t = &old_parse->tokens[i];
+
+    if (t->is_pair != 0) {
+      int unp_count = (int)pos - 1 - ((word_mode != 0) ? 0 : 1);
+      uint16_t up = unp_limit(unp_count);
+
+      uint16_t token_val_from = old_parse->max_from;
+
+      if (token_val_from > up) {
+        token_val_from = up;
+      }
+
+      if (t->from > token_val_from || pos < base + t->from || pos - base - t->from < change_end) {
+        return 0;
+      }
+    }
+
+    pos += t->len;
+  }
+
+  return 1;
+}
+
+int compress_incremental(const uint8_t* old_src, uint32_t old_size, const parse_t* old_parse, const uint8_t* src, uint32_t src_size, uint8_t* dst, parse_t* parse) {
+  if (old_src == NULL || old_parse == NULL || src == NULL || dst == NULL) {
+    return -1;
+  }
+
+  int word_mode = old_parse->word_mode;
+  uint32_t stride = (word_mode != 0) ? 2u : 1u;
+
+  if ((old_size % stride) != 0u || (src_size % stride) != 0u || old_parse->total_elems != old_size / stride ||
+      old_parse->src_hash != hash_data(old_src, old_size)) {
+    return compress_with_parse(src, src_size, dst, parse);
+  }
+
+  uint16_t max_from = old_parse->max_from;
+  uint16_t max_count = old_parse->max_count;
+  uint32_t old_elems = old_size / stride;
+  uint32_t total_elems = src_size / stride;
+  uint32_t common = (old_elems < total_elems) ? old_elems : total_elems;
+
+  uint32_t first = 0u;
+  while (first < common && memcmp(old_src + first * stride, src + first * stride, stride) == 0) {
+    ++first;
+  }
+
+  uint32_t tail = 0u;
+  while (tail < common - first && memcmp(old_src + (old_elems - 1u - tail) * stride, src + (total_elems - 1u - tail) * stride, stride) == 0) {
+    ++tail;
+  }
+
+  uint32_t change_end = total_elems - tail;
+  uint32_t sync_from = change_end + (uint32_t)max_from + ((word_mode != 0) ? 1u : 2u);
+
+  uint32_t* old_starts = (uint32_t*)malloc(((old_parse->count == 0u) ? 1u : old_parse->count) * sizeof(uint32_t));
+  if (old_starts == NULL) {
+    return -1;
+  }
+
+  uint32_t old_pos = 0u;
+  for (uint32_t i = 0u; i < old_parse->count; ++i) {
+    old_starts[i] = old_pos;
+    old_pos += old_parse->tokens[i].len;
+  }
+
+  parse_t out;
+  init_parse(&out, word_mode, max_from, max_count, total_elems);
+
+  uint32_t pos = 0u;
+  uint32_t k = 0u;
+  while (k < old_parse->count && pos + old_parse->tokens[k].len <= first) {
+    const parse_token_t* t = &old_parse->tokens[k];
+
+    if (parse_push(&out, t->is_pair, t->from, t->len) != 0) {
+      free(old_starts);
+      free_parse(&out);
+      return -1;
+    }
+
+    pos += t->len;
+    ++k;
+  }
+
+  while (pos < total_elems) {
+    uint32_t group_start = out.count;
+    uint32_t bound = pos;
+
+    if (parse_group(src, total_elems, max_from, max_count, word_mode, pos, NULL, &out, &pos) != 0) {
+      free(old_starts);
+      free_parse(&out);
+      return -1;
+    }
+
+    for (uint32_t i = group_start; i < out.count && pos < total_elems; ++i) {
+      bound += out.tokens[i].len;
+
+      if (bound < sync_from || bound >= total_elems) {
+        continue;
+      }
+
+      int index = find_token_start(old_starts, old_parse->count, old_elems - (total_elems - bound));
+
+      if (index < 0 || !can_splice_tail(old_parse, (uint32_t)index, bound, change_end)) {
+        continue;
+      }
+
+      out.count = i + 1u;
+
+      for (uint32_t j = (uint32_t)index; j < old_parse->count; ++j) {
+        const parse_token_t* t = &old_parse->tokens[j];
+
+        if (parse_push(&out, t->is_pair, t->from, t->len) != 0) {
+          free(old_starts);
+          free_parse(&out);
+          return -1;
+        }
+      }
+
+      pos = total_elems;
+    }
+  }
+
+  free(old_starts);
+
+  int size = emit_parse(src, &out, dst);
+
+  if (size < 0) {
+    free_parse(&out);
+    return compress_with_parse(src, src_size, dst, parse);
+  }
+
+  if (parse != NULL) {
+    out.src_hash = hash_data(src, src_size);
+    *parse = out;
+  }
+  else {
+    free_parse(&out);
+  }
+
+  return size;
+}
+
+static const uint32_t estimate_chain_depth = 64u;
+static const uint32_t estimate_full_elems = 1u << 20;
+static const uint32_t estimate_window_elems = 4096u;
+static const uint32_t estimate_warmup_elems = 1024u;
+static const double estimate_bias = 0.02;
+static const double estimate_margin = 0.04;
+
+static int estimate_window(const uint8_t* src, uint32_t total_elems, int word_mode, const match_chain_t* chain, uint32_t start, uint32_t len, uint32_t* out_elems, double* out_bits) {
+  uint32_t stride = (word_mode != 0) ? 2u : 1u;
+
+  parse_t parse;
+  init_parse(&parse, word_mode, 0xFFFF, 0xFFFF, total_elems);
+
+  uint32_t warmup = (start < estimate_warmup_elems) ? start : estimate_warmup_elems;
+  uint32_t pos = start - warmup;
+  while (pos < start + len && pos < total_elems) {
+    if (parse_group(src, total_elems, 0xFFFF, 0xFFFF, word_mode, pos, chain, &parse, &pos) != 0) {
+      free_parse(&parse);
+      return -1;
+    }
+  }
+
+  uint32_t end = (pos < start + len) ? pos : (start + len);
+  double bits = 0.0;
+  uint32_t p = start - warmup;
+
+  for (uint32_t i = 0u; i < parse.count && p < end; ++i) {
+    const parse_token_t* t = &parse.tokens[i];
+    double token_bits = 0.0;
+
+    if (t->is_pair == 0) {
+      token_bits = (double)t->len * (1.0 + 8.0 * (double)stride);
+    }
+    else {
+      int unp_count = (int)p - 1 - ((word_mode != 0) ? 0 : 1);
+      int cost = pair_bit_cost(0xFFFF, 0xFFFF, word_mode, unp_count, t->from, (uint16_t)t->len);
+
+      if (cost < 0) {
+        free_parse(&parse);
+        return -1;
+      }
+
+      token_bits = 1.0 + (double)cost;
+    }
+
+    uint32_t lo = (p > start) ? p : start;
+    uint32_t hi = (p + t->len < end) ? (p + t->len) : end;
+
+    if (hi <= lo) {
+      p += t->len;
+      continue;
+    }
+
+    token_bits *= (double)(hi - lo) / (double)t->len;
+
+    bits += token_bits;
+    p += t->len;
+  }
+
+  free_parse(&parse);
+
+  *out_elems = end - start;
+  *out_bits = bits;
+  return 0;
+}
+
+int estimate_compressed_size(const uint8_t* src, uint32_t src_size, int word_mode, size_estimate_t* estimate) {
+  if (src == NULL || estimate == NULL) {
+    return -1;
+  }
+
+  if (word_mode != 0 && (src_size % 2u) != 0u) {
+    return -1;
+  }
+
+  uint32_t total_elems = (word_mode != 0) ? (src_size / 2u) : src_size;
+  uint32_t window = estimate_window_elems;
+  uint32_t windows = total_elems / (window * 4u);
+
+  if (windows < 64u) {
+    windows = 64u;
+  }
+
+  if (total_elems <= estimate_full_elems || (uint64_t)windows * (window + estimate_warmup_elems) >= total_elems) {
+    windows = 1u;
+    window = total_elems;
+  }
+
+  match_chain_t chain;
+
+  if (init_match_chain(src, total_elems, word_mode, estimate_chain_depth, &chain) != 0) {
+    return -1;
+  }
+
+  double sum_bits = 0.0;
+  double sum_elems = 0.0;
+  double sum_ratio = 0.0;
+  double sum_ratio_sq = 0.0;
+
+  for (uint32_t i = 0u; i < windows; ++i) {
+    uint32_t start = (windows == 1u) ? 0u : (uint32_t)(((uint64_t)(total_elems - window) * i) / (windows - 1u));
+    uint32_t elems = 0u;
+    double bits = 0.0;
+
+    if (estimate_window(src, total_elems, word_mode, &chain, start, window, &elems, &bits) != 0) {
+      free_match_chain(&chain);
+      return -1;
+    }
+
+    if (elems == 0u) {
+      continue;
+    }
+
+    double ratio = bits / (double)elems;
+
+    sum_bits += bits;
+    sum_elems += (double)elems;
+    sum_ratio += ratio;
+    sum_ratio_sq += ratio * ratio;
+  }
+
+  double bits = (sum_elems > 0.0) ? (sum_bits / sum_elems * (double)total_elems) : 0.0;
+  double error_bits = 0.0;
+
+  if (windows > 1u) {
+    double mean = sum_ratio / (double)windows;
+    double variance = (sum_ratio_sq - (double)windows * mean * mean) / (double)(windows - 1u);
+    double sampled = sum_elems / (double)total_elems;
+
+    if (variance < 0.0) {
+      variance = 0.0;
+    }
+
+    if (sampled > 1.0) {
+      sampled = 1.0;
+    }
+
+    error_bits = 2.0 * sqrt(variance / (double)windows * (1.0 - sampled)) * (double)total_elems;
+  }
+
+  free_match_chain(&chain);
+  bits -= bits * estimate_bias;
+  error_bits += bits * estimate_margin;
+
+  estimate->word_mode = word_mode;
+  estimate->size = 12u + 4u * (uint32_t)ceil((bits + 1.0) / 32.0);
+  estimate->error = (uint32_t)ceil(error_bits / 8.0) + 4u;
+  estimate->parsed = (uint32_t)sum_elems;
+  estimate->total = total_elems;
+  return 0;
+}
+
 uint32_t max_compressed_size(uint32_t src_size) {
   uint32_t a = src_size + 64u;
   uint32_t b = src_size / 4u;
@@ -586,3 +1342,638 @@ uint32_t max_compressed_size(uint32_t src_size) {
 
   return c;
 }
+
+static const uint32_t stream_ring_size = 1u << 18;
+static const uint32_t stream_hash_size = 1u << 16;
+static const uint32_t stream_chain_depth = 128u;
+static const uint32_t stream_no_pos = 0xFFFFFFFFu;
+
+typedef struct stream_ctx_t {
+  FILE* in;
+  int word_mode;
+  int eof;
+  int odd;
+  uint32_t filled;
+  uint32_t inserted;
+  uint16_t* ring;
+  uint32_t* prev;
+  uint32_t* head;
+} stream_ctx_t;
+
+static uint16_t stream_elem(const stream_ctx_t* ctx, uint32_t pos) {
+  return ctx->ring[pos & (stream_ring_size - 1u)];
+}
+
+static void stream_fill(stream_ctx_t* ctx, uint32_t pos) {
+  uint32_t stride = (ctx->word_mode != 0) ? 2u : 1u;
+  uint32_t want = pos + 0x10000u;
+  uint8_t buf[4096];
+
+  while (ctx->eof == 0 && ctx->filled < want) {
+    uint32_t n = (want - ctx->filled) * stride;
+
+    if (n > sizeof(buf)) {
+      n = sizeof(buf);
+    }
+
+    size_t got = fread(buf, 1, n, ctx->in);
+
+    if (got < n) {
+      ctx->eof = 1;
+    }
+
+    if ((got % stride) != 0u) {
+      ctx->odd = 1;
+    }
+
+    for (size_t i = 0; i + stride <= got; i += stride) {
+      uint16_t value = (ctx->word_mode != 0) ? (uint16_t)((buf[i] << 8) | buf[i + 1]) : buf[i];
+      ctx->ring[ctx->filled & (stream_ring_size - 1u)] = value;
+      ctx->filled += 1u;
+    }
+  }
+}
+
+static uint32_t stream_hash(const stream_ctx_t* ctx, uint32_t pos) {
+  uint32_t h = (uint32_t)stream_elem(ctx, pos) * 0x9E3779B1u;
+  h ^= (uint32_t)stream_elem(ctx, pos + 1u) * 0x85EBCA6Bu;
+
+  if (ctx->word_mode == 0) {
+    h ^= (uint32_t)stream_elem(ctx, pos + 2u) * 0xC2B2AE35u;
+  }
+
+  return h >> 16;
+}
+
+static void stream_insert(stream_ctx_t* ctx, uint32_t upto) {
+  uint32_t need = (ctx->word_mode != 0) ? 2u : 3u;
+
+  while (ctx->inserted < upto && ctx->inserted + need <= ctx->filled) {
+    uint32_t h = stream_hash(ctx, ctx->inserted);
+    ctx->prev[ctx->inserted & (stream_ring_size - 1u)] = ctx->head[h];
+    ctx->head[h] = ctx->inserted;
+    ctx->inserted += 1u;
+  }
+}
+
+static uint32_t stream_find_period(const stream_ctx_t* ctx, uint32_t pos, uint32_t lowest, uint32_t* run_start, uint32_t* run_end) {
+  uint32_t limit = (ctx->filled - pos > 0xFFFFu) ? (pos + 0xFFFFu) : ctx->filled;
+  uint32_t period = 0u;
+  uint32_t end = pos;
+
+  for (uint32_t p = 1u; p <= 4u && p <= pos; ++p) {
+    uint32_t e = pos;
+
+    while (e < limit && stream_elem(ctx, e) == stream_elem(ctx, e - p)) {
+      ++e;
+    }
+
+    if (e > end) {
+      end = e;
+      period = p;
+    }
+  }
+
+  if (period == 0u || end - pos < 16u) {
+    return 0u;
+  }
+
+  uint32_t start = pos;
+
+  while (start > lowest + period && stream_elem(ctx, start - 1u) == stream_elem(ctx, start - 1u - period)) {
+    --start;
+  }
+
+  *run_start = start;
+  *run_end = end;
+  return period;
+}
+
+static match_t stream_find_match(stream_ctx_t* ctx, uint32_t pos, int unp_count) {
+  match_t best = { 0, 0 };
+
+  int word_mode = ctx->word_mode;
+  uint32_t base = (word_mode != 0) ? 1u : 2u;
+  uint32_t extra = (word_mode != 0) ? 0u : 1u;
+  uint32_t need = (word_mode != 0) ? 2u : 3u;
+
+  stream_fill(ctx, pos);
+
+  if (pos < base || pos + need > ctx->filled) {
+    return best;
+  }
+
+  stream_insert(ctx, pos);
+
+  uint32_t max_from_u = unp_limit(unp_count);
+
+  if (max_from_u > pos - base) {
+    max_from_u = pos - base;
+  }
+
+  double best_score = 1e100;
+  uint32_t cand = ctx->head[stream_hash(ctx, pos)];
+
+  for (uint32_t depth = 0u; cand != stream_no_pos && depth < stream_chain_depth; ++depth, cand = ctx->prev[cand & (stream_ring_size - 1u)]) {
+    if (cand + base > pos) {
+      continue;
+    }
+
+    uint32_t from = pos - base - cand;
+
+    if (from > max_from_u) {
+      break;
+    }
+
+    uint32_t maxlen = from + 1u + extra;
+
+    if (maxlen > 0xFFFFu) {
+      maxlen = 0xFFFFu;
+    }
+
+    if (maxlen > ctx->filled - pos) {
+      maxlen = ctx->filled - pos;
+    }
+
+    uint32_t len = 0u;
+    while (len < maxlen && stream_elem(ctx, pos + len) == stream_elem(ctx, cand + len)) {
+      ++len;
+    }
+
+    score_match(0xFFFF, 0xFFFF, word_mode, unp_count, from, len, &best, &best_score);
+  }
+
+  uint32_t run_start = pos;
+  uint32_t run_end = pos;
+  uint32_t period = stream_find_period(ctx, pos, pos - base - max_from_u, &run_start, &run_end);
+
+  if (period != 0u) {
+    score_run_candidates(0xFFFF, 0xFFFF, word_mode, unp_count, pos, period, run_start, run_end, max_from_u, &best, &best_score);
+  }
+
+  return best;
+}
+
+static void stream_spool_literals(const stream_ctx_t* ctx, FILE* spool, uint32_t start, uint32_t count) {
+  for (uint32_t i = 0u; i < count; ++i) {
+    uint16_t value = stream_elem(ctx, start + i);
+
+    if (ctx->word_mode != 0) {
+      fputc((value >> 8) & 0xFF, spool);
+    }
+
+    fputc(value & 0xFF, spool);
+  }
+}
+
+static int copy_spool(FILE* spool, FILE* out) {
+  uint8_t buf[4096];
+  size_t got = 0;
+
+  rewind(spool);
+
+  while ((got = fread(buf, 1, sizeof(buf), spool)) != 0) {
+    if (fwrite(buf, 1, got, out) != got) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+static int stream_parse(stream_ctx_t* ctx, bitwriter_t* bw, FILE* lit_spool) {
+  int word_mode = ctx->word_mode;
+  int init_unp = -1 - ((word_mode != 0) ? 0 : 1);
+
+  uint32_t pos = 0u;
+
+  while (1) {
+    stream_fill(ctx, pos);
+
+    if (pos >= ctx->filled) {
+      break;
+    }
+
+    uint32_t start_pos = pos;
+    uint32_t lit_len = 1u;
+
+    if (start_pos == 0u) {
+      lit_len = (word_mode != 0) ? 1u : 2u;
+
+      if (lit_len > ctx->filled) {
+        lit_len = ctx->filled;
+      }
+    }
+
+    while (1) {
+      uint32_t after = start_pos + lit_len;
+      stream_fill(ctx, after);
+
+      if (after >= ctx->filled || lit_len == 0xFFFFu) {
+        break;
+      }
+
+      if (stream_find_match(ctx, after, init_unp + (int)after).len != 0u) {
+        break;
+      }
+      ++lit_len;
+    }
+
+    write_count(bw, lit_len - 1u);
+    stream_spool_literals(ctx, lit_spool, start_pos, lit_len);
+
+    pos = start_pos + lit_len;
+    stream_fill(ctx, pos);
+
+    if (pos >= ctx->filled) {
+      break;
+    }
+
+    match_t pairs[256];
+    uint32_t npairs = 0u;
+
+    while (npairs < 256u) {
+      int unp_count = init_unp + (int)pos;
+      match_t m0 = stream_find_match(ctx, pos, unp_count);
+
+      if (m0.len == 0u) {
+        break;
+      }
+
+      match_t m1 = stream_find_match(ctx, pos + 1u, unp_count + 1);
+
+      if (m1.len != 0u) {
+        int bits0 = pair_bit_cost(0xFFFF, 0xFFFF, word_mode, unp_count, m0.from, m0.len);
+        int bits1 = pair_bit_cost(0xFFFF, 0xFFFF, word_mode, unp_count + 1, m1.from, m1.len);
+
+        double r0 = (bits0 > 0) ? ((double)bits0 / (double)m0.len) : 1e100;
+        double r1 = (bits1 > 0) ? ((double)bits1 / (double)m1.len) : 1e100;
+
+        if (r1 + 0.02 < r0 && npairs > 0u) {
+          break;
+        }
+      }
+
+      pairs[npairs++] = m0;
+      pos += m0.len;
+
+      stream_fill(ctx, pos);
+
+      if (pos >= ctx->filled) {
+        break;
+      }
+    }
+
+    if (npairs == 0u) {
+      return -1;
+    }
+
+    write_count(bw, npairs - 1u);
+
+    uint32_t unp_pos = pos;
+    for (uint32_t i = 0u; i < npairs; ++i) {
+      unp_pos -= pairs[i].len;
+    }
+
+    for (uint32_t i = 0u; i < npairs; ++i) {
+      uint16_t token_val_from = unp_limit(init_unp + (int)unp_pos);
+      uint16_t token_val_cnt = pairs[i].from;
+      uint16_t extra = (word_mode != 0) ? 0u : 1u;
+
+      if (write_token(bw, token_val_from, pairs[i].from) != 0) {
+        return -1;
+      }
+
+      if (write_token(bw, token_val_cnt, (uint16_t)(pairs[i].len - 1u - extra)) != 0) {
+        return -1;
+      }
+
+      unp_pos += pairs[i].len;
+    }
+  }
+
+  return 0;
+}
+
+static int stream_compress_pass(FILE* in, FILE* out, int word_mode) {
+  stream_ctx_t ctx;
+  ctx.in = in;
+  ctx.word_mode = (word_mode != 0) ? 1 : 0;
+  ctx.eof = 0;
+  ctx.odd = 0;
+  ctx.filled = 0u;
+  ctx.inserted = 0u;
+  ctx.ring = (uint16_t*)malloc(stream_ring_size * sizeof(uint16_t));
+  ctx.prev = (uint32_t*)malloc(stream_ring_size * sizeof(uint32_t));
+  ctx.head = (uint32_t*)malloc(stream_hash_size * sizeof(uint32_t));
+
+  FILE* token_spool = tmpfile();
+  FILE* lit_spool = tmpfile();
+
+  int result = -1;
+
+  if (ctx.ring != NULL && ctx.prev != NULL && ctx.head != NULL && token_spool != NULL && lit_spool != NULL) {
+    memset(ctx.head, 0xFF, stream_hash_size * sizeof(uint32_t));
+
+    bitwriter_t bw;
+    bw_init_spool(&bw, token_spool);
+    bw_putbit(&bw, ctx.word_mode);
+
+    if (stream_parse(&ctx, &bw, lit_spool) == 0 && ctx.odd == 0) {
+      bw_finish(&bw);
+
+      uint32_t stride = (ctx.word_mode != 0) ? 2u : 1u;
+      uint64_t size = 12u + (uint64_t)bw.tokens * 4u;
+      uint64_t lit_size = (uint64_t)ftell(lit_spool);
+
+      uint8_t header[12];
+      int woff = 0;
+      write_dword_be(header, &woff, ctx.filled * stride);
+      write_dword_be(header, &woff, 4u + bw.tokens * 4u);
+      write_word_be(header, &woff, 0xFFFF);
+      write_word_be(header, &woff, 0xFFFF);
+
+      size += lit_size;
+
+      if (size <= 0x7FFFFFFFu && fwrite(header, 1, sizeof(header), out) == sizeof(header) &&
+          copy_spool(token_spool, out) == 0 && copy_spool(lit_spool, out) == 0) {
+        result = (int)size;
+      }
+    }
+  }
+
+  if (lit_spool != NULL) {
+    fclose(lit_spool);
+  }
+
+  if (token_spool != NULL) {
+    fclose(token_spool);
+  }
+
+  free(ctx.head);
+  free(ctx.prev);
+  free(ctx.ring);
+  return result;
+}
+
+int compress_stream(FILE* in, FILE* out, int word_mode) {
+  if (in == NULL || out == NULL) {
+    return -1;
+  }
+
+  long in_start = ftell(in);
+  long out_start = ftell(out);
+
+  int size = stream_compress_pass(in, out, word_mode);
+
+  if (size < 0 && word_mode != 0 && in_start >= 0 && ftell(out) == out_start && fseek(in, in_start, SEEK_SET) == 0) {
+    size = stream_compress_pass(in, out, 0);
+  }
+
+  return size;
+}
+
+static const uint32_t parallel_min_segment = 0x4000u;
+static const int parallel_max_threads = 64;
+
+typedef struct segment_job_t {
+  const uint8_t* src;
+  uint32_t total_elems;
+  uint16_t max_from;
+  uint16_t max_count;
+  int word_mode;
+  uint32_t start;
+  uint32_t end;
+  parse_t parse;
+  int result;
+} segment_job_t;
+
+static int parse_segment(segment_job_t* job) {
+  uint32_t pos = job->start;
+
+  while (pos < job->end) {
+    if (parse_group(job->src, job->total_elems, job->max_from, job->max_count, job->word_mode, pos, NULL, &job->parse, &pos) != 0) {
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI segment_thread(LPVOID arg) {
+  segment_job_t* job = (segment_job_t*)arg;
+  job->result = parse_segment(job);
+  return 0;
+}
+
+static int cpu_count() {
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int)info.dwNumberOfProcessors;
+}
+
+static void run_segment_jobs(segment_job_t* jobs, int count) {
+  HANDLE threads[64];
+
+  for (int i = 1; i < count; ++i) {
+    threads[i] = CreateThread(NULL, 0, segment_thread, &jobs[i], 0, NULL);
+
+    if (threads[i] == NULL) {
+      jobs[i].result = parse_segment(&jobs[i]);
+    }
+  }
+
+  jobs[0].result = parse_segment(&jobs[0]);
+
+  for (int i = 1; i < count; ++i) {
+    if (threads[i] != NULL) {
+      WaitForSingleObject(threads[i], INFINITE);
+      CloseHandle(threads[i]);
+    }
+  }
+}
+#else
+static void* segment_thread(void* arg) {
+  segment_job_t* job = (segment_job_t*)arg;
+  job->result = parse_segment(job);
+  return NULL;
+}
+
+static int cpu_count() {
+  long count = sysconf(_SC_NPROCESSORS_ONLN);
+  return (count > 0) ? (int)count : 1;
+}
+
+static void run_segment_jobs(segment_job_t* jobs, int count) {
+  pthread_t threads[64];
+  int started[64] = { 0 };
+
+  for (int i = 1; i < count; ++i) {
+    started[i] = (pthread_create(&threads[i], NULL, segment_thread, &jobs[i]) == 0);
+
+    if (!started[i]) {
+      jobs[i].result = parse_segment(&jobs[i]);
+    }
+  }
+
+  jobs[0].result = parse_segment(&jobs[0]);
+
+  for (int i = 1; i < count; ++i) {
+    if (started[i]) {
+      pthread_join(threads[i], NULL);
+    }
+  }
+}
+#endif
+
+static int stitch_push(parse_t* parse, uint8_t is_pair, uint16_t from, uint32_t len) {
+  parse_token_t* last = (parse->count != 0u) ? &parse->tokens[parse->count - 1u] : NULL;
+
+  if (is_pair == 0 && last != NULL && last->is_pair == 0) {
+    if (last->len + len > 0xFFFFu) {
+      return -1;
+    }
+
+    last->len += len;
+    return 0;
+  }
+
+  return parse_push(parse, is_pair, from, len);
+}
+
+static int stitch_segment(const segment_job_t* job, parse_t* out, uint32_t* covered) {
+  int word_mode = job->word_mode;
+  uint32_t pos = job->start;
+
+  for (uint32_t i = 0u; i < job->parse.count; ++i) {
+    const parse_token_t* t = &job->parse.tokens[i];
+    uint32_t end = pos + t->len;
+
+    if (end <= *covered) {
+      pos = end;
+      continue;
+    }
+
+    uint8_t is_pair = t->is_pair;
+    uint16_t from = t->from;
+    uint32_t len = t->len;
+
+    if (pos < *covered) {
+      len = end - *covered;
+      pos = *covered;
+
+      int unp_count = (int)pos - 1 - ((word_mode != 0) ? 0 : 1);
+
+      if (is_pair != 0 && pair_bit_cost(job->max_from, job->max_count, word_mode, unp_count, from, (uint16_t)len) < 0) {
+        is_pair = 0;
+        from = 0;
+      }
+    }
+
+    if (stitch_push(out, is_pair, from, len) != 0) {
+      return -1;
+    }
+
+    pos = end;
+    *covered = end;
+  }
+
+  return 0;
+}
+
+static int compress_segmented(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint16_t max_from, uint16_t max_count, int prefer_word_mode, int threads) {
+  int word_mode = 0;
+
+  if (prefer_word_mode != 0 && (src_size % 2u) == 0u) {
+    word_mode = 1;
+  }
+
+  uint32_t total_elems = (word_mode != 0) ? (src_size / 2u) : src_size;
+  int segments = threads;
+
+  while (segments > 1 && total_elems / (uint32_t)segments < parallel_min_segment) {
+    --segments;
+  }
+
+  segment_job_t* jobs = (segment_job_t*)calloc(segments, sizeof(segment_job_t));
+
+  if (jobs == NULL) {
+    return -1;
+  }
+
+  for (int i = 0; i < segments; ++i) {
+    segment_job_t* job = &jobs[i];
+    job->src = src;
+    job->total_elems = total_elems;
+    job->max_from = max_from;
+    job->max_count = max_count;
+    job->word_mode = word_mode;
+    job->start = (uint32_t)((uint64_t)total_elems * i / segments);
+    job->end = (uint32_t)((uint64_t)total_elems * (i + 1) / segments);
+    init_parse(&job->parse, word_mode, max_from, max_count, total_elems);
+  }
+
+  run_segment_jobs(jobs, segments);
+
+  parse_t out;
+  init_parse(&out, word_mode, max_from, max_count, total_elems);
+
+  int size = 0;
+  uint32_t covered = 0u;
+
+  for (int i = 0; i < segments && size == 0; ++i) {
+    if (jobs[i].result != 0 || stitch_segment(&jobs[i], &out, &covered) != 0) {
+      size = -1;
+    }
+  }
+
+  for (int i = 0; i < segments; ++i) {
+    free_parse(&jobs[i].parse);
+  }
+
+  free(jobs);
+
+  if (size == 0) {
+    size = emit_parse(src, &out, dst);
+  }
+
+  free_parse(&out);
+  return size;
+}
+
+int compress_parallel(const uint8_t* src, uint32_t src_size, uint8_t* dst, int threads) {
+  if (src == NULL || dst == NULL) {
+    return -1;
+  }
+
+  if (threads <= 0) {
+    threads = cpu_count();
+  }
+
+  if (threads > parallel_max_threads) {
+    threads = parallel_max_threads;
+  }
+
+  int s0 = compress_segmented(src, src_size, dst, 0xFFFF, 0xFFFF, 0, threads);
+
+  if ((src_size % 2u) != 0u) {
+    return s0;
+  }
+
+  uint8_t* tmp = (uint8_t*)malloc(max_compressed_size(src_size));
+
+  if (tmp == NULL) {
+    return s0;
+  }
+
+  int s1 = compress_segmented(src, src_size, tmp, 0xFFFF, 0xFFFF, 1, threads);
+
+  if (s1 >= 0 && (s0 < 0 || s1 < s0)) {
+    memcpy(dst, tmp, s1);
+    s0 = s1;
+  }
+
+  free(tmp);
+  return s0;
+}
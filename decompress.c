@@ -1,5 +1,8 @@
 #include "main.h"
 
+#include <stdlib.h>
+#include <string.h>
+
 static uint8_t read_byte(const uint8_t* src, int offset) {
   return src[offset];
 }
@@ -13,7 +16,7 @@ static uint16_t read_word(const uint8_t* src, int offset) {
 static uint32_t read_dword(const uint8_t* src, int offset) {
   uint16_t w1 = read_word(src, offset); offset += 2;
   uint16_t w2 = read_word(src, offset);
-  return (w1 << 16) | (w2 << 0);
+  return ((uint32_t)w1 << 16) | ((uint32_t)w2 << 0);
 }
 
 static void write_byte(uint8_t* dst, int* offset, uint8_t value) {
@@ -34,7 +37,7 @@ static int getbit(const uint8_t* src, int* roff, int* bits, uint32_t* token) {
     *bits = 0x1F;
   }
 
-  return ((*token) & (1 << (*bits))) ? 1 : 0;
+  return ((*token) & (1u << (*bits))) ? 1 : 0;
 }
 
 static uint32_t getbits(const uint8_t* src, int* roff, int count, int* bits, uint32_t* token) {
@@ -47,17 +50,21 @@ static uint32_t getbits(const uint8_t* src, int* roff, int count, int* bits, uin
   return result;
 }
 
-static uint16_t read_token(const uint8_t* src, int* roff, uint16_t value, int* bits, uint32_t* token) {
-  const item_t* tbl = NULL;
-
-  for (int i = 0; i < sizeof(table) / sizeof(table[0]); ++i) {
-    tbl = &table[i];
+static uint32_t table_row(uint16_t value) {
+  uint32_t last = sizeof(table) / sizeof(table[0]) - 1;
 
-    if (tbl->items[0].w0 >= value) {
-      break;
+  for (uint32_t i = 0; i < last; ++i) {
+    if (table[i].items[0].w0 >= value) {
+      return i;
     }
   }
 
+  return last;
+}
+
+static uint16_t read_token(const uint8_t* src, int* roff, uint16_t value, int* bits, uint32_t* token) {
+  const item_t* tbl = &table[table_row(value)];
+
   if (tbl->index == 0) {
     return getbits(src, roff, tbl->items[0].w2, bits, token);
   }
@@ -181,3 +188,1011 @@ int decompress(const uint8_t* src, uint8_t* dst, uint32_t* src_size) {
 
   return woff;
 }
+
+typedef struct decoder_t {
+  int roff;
+  int bits;
+  uint32_t token;
+  uint32_t data_off;
+  uint32_t left;
+  int unp_count;
+  uint32_t out_pos;
+  uint32_t pairs_left;
+  uint32_t pause_pos;
+  decode_profile_t* profile;
+} decoder_t;
+
+typedef struct decode_refs_t {
+  uint32_t limit;
+  uint32_t count;
+  uint32_t capacity;
+  decode_span_t* spans;
+} decode_refs_t;
+
+static int push_ref(decode_refs_t* refs, uint32_t start, uint32_t len) {
+  if (refs->count == refs->capacity) {
+    uint32_t capacity = (refs->capacity == 0) ? 64 : (refs->capacity * 2);
+    decode_span_t* spans = (decode_span_t*)realloc(refs->spans, capacity * sizeof(decode_span_t));
+
+    if (spans == NULL) {
+      return -1;
+    }
+
+    refs->spans = spans;
+    refs->capacity = capacity;
+  }
+
+  decode_span_t* span = &refs->spans[refs->count++];
+  span->start = start;
+  span->len = len;
+  span->offset = 0;
+  return 0;
+}
+
+static int decode_group(const uint8_t* src, const decode_index_t* index, decoder_t* d, uint8_t* dst, int* woff, uint32_t stop_pos, decode_refs_t* refs) {
+  int word_mode = index->word_mode;
+  uint32_t stride = word_mode ? 2 : 1;
+  uint16_t count;
+
+  if (d->pairs_left == 0) {
+    count = read_count(src, &d->roff, &d->bits, &d->token) + 1;
+
+    if (count > d->left) {
+      return -1;
+    }
+
+    d->left -= count;
+    d->unp_count += count;
+
+    if (d->profile != NULL) {
+      d->profile->count_reads += 1;
+      d->profile->literal_runs += 1;
+      d->profile->literal_elems += count;
+    }
+
+    if (dst == NULL) {
+      d->data_off += count * stride;
+      d->out_pos += count;
+    }
+    else {
+      for (uint16_t i = 0; i < count; ++i) {
+        if (d->out_pos >= stop_pos) {
+          return 1;
+        }
+
+        if (word_mode) {
+          write_word(dst, woff, read_word(src, d->data_off));
+        }
+        else {
+          write_byte(dst, woff, read_byte(src, d->data_off));
+        }
+
+        d->data_off += stride;
+        d->out_pos += 1;
+      }
+    }
+
+    if (d->left == 0) {
+      return 1;
+    }
+
+    uint16_t pairs = read_count(src, &d->roff, &d->bits, &d->token) + 1;
+    d->pairs_left = pairs;
+
+    if (d->profile != NULL) {
+      d->profile->count_reads += 1;
+    }
+  }
+
+  while (d->pairs_left != 0) {
+    uint16_t token_val = index->max_from;
+
+    if (index->max_from >= d->unp_count) {
+      token_val = d->unp_count;
+    }
+
+    uint16_t from = read_token(src, &d->roff, token_val, &d->bits, &d->token);
+
+    if (d->profile != NULL) {
+      d->profile->table_steps += table_row(token_val) + 1;
+    }
+
+    token_val = index->max_count;
+
+    if (index->max_count >= from) {
+      token_val = from;
+    }
+
+    count = read_token(src, &d->roff, token_val, &d->bits, &d->token) + 1 + (word_mode ? 0 : 1);
+
+    if (count > d->left) {
+      return -1;
+    }
+
+    d->left -= count;
+    d->unp_count += count;
+    d->pairs_left -= 1;
+
+    if (d->profile != NULL) {
+      d->profile->table_steps += table_row(token_val) + 1;
+      d->profile->token_reads += 2;
+      d->profile->pairs += 1;
+      d->profile->match_elems += count;
+    }
+
+    uint32_t back = (word_mode ? 1 : 2) + from;
+
+    if (d->out_pos < back) {
+      return -1;
+    }
+
+    if (refs != NULL && d->out_pos - back < refs->limit) {
+      uint32_t ref_start = d->out_pos - back;
+      uint32_t ref_end = (ref_start + count < refs->limit) ? (ref_start + count) : refs->limit;
+
+      if (push_ref(refs, ref_start, ref_end - ref_start) != 0) {
+        return -1;
+      }
+    }
+
+    if (dst == NULL) {
+      d->out_pos += count;
+    }
+    else {
+      int curr = *woff - (int)(back * stride);
+
+      if (curr < 0) {
+        return -1;
+      }
+
+      for (uint16_t j = 0; j < count; ++j) {
+        if (d->out_pos >= stop_pos) {
+          return 1;
+        }
+
+        if (word_mode) {
+          write_word(dst, woff, read_word(dst, curr + j * 2));
+        }
+        else {
+          write_byte(dst, woff, read_byte(dst, curr + j));
+        }
+
+        d->out_pos += 1;
+      }
+    }
+
+    if (d->pairs_left != 0 && d->out_pos >= d->pause_pos) {
+      return 0;
+    }
+  }
+
+  return 0;
+}
+
+static int push_checkpoint(decode_index_t* index, uint32_t* capacity, const decoder_t* d) {
+  if (index->count == *capacity) {
+    uint32_t new_capacity = (*capacity == 0) ? 64 : (*capacity * 2);
+    decode_checkpoint_t* points = (decode_checkpoint_t*)realloc(index->points, new_capacity * sizeof(decode_checkpoint_t));
+
+    if (points == NULL) {
+      return -1;
+    }
+
+    index->points = points;
+    *capacity = new_capacity;
+  }
+
+  decode_checkpoint_t* p = &index->points[index->count++];
+  p->out_pos = d->out_pos;
+  p->roff = (uint32_t)d->roff;
+  p->bits = d->bits;
+  p->token = d->token;
+  p->data_off = d->data_off;
+  p->left = d->left;
+  p->unp_count = d->unp_count;
+  p->pairs_left = d->pairs_left;
+  p->min_ref = d->out_pos;
+  p->first_span = 0;
+  p->span_count = 0;
+  return 0;
+}
+
+static void decoder_start(const uint8_t* src, decode_index_t* index, decoder_t* d) {
+  d->roff = 0;
+  d->left = read_dword(src, d->roff); d->roff += 4;
+  d->data_off = read_dword(src, d->roff) + 8; d->roff += 4;
+
+  index->max_from = read_word(src, d->roff); d->roff += 2;
+  index->max_count = read_word(src, d->roff); d->roff += 2;
+  d->token = read_dword(src, d->roff); d->roff += 4;
+  d->bits = 0x20;
+
+  index->word_mode = getbit(src, &d->roff, &d->bits, &d->token);
+  d->left >>= index->word_mode ? 1 : 0;
+
+  d->unp_count = -1 - (index->word_mode ? 0 : 1);
+  d->out_pos = 0;
+  d->pairs_left = 0;
+  d->pause_pos = 0xFFFFFFFF;
+  d->profile = NULL;
+
+  index->total_elems = d->left;
+  index->count = 0;
+  index->points = NULL;
+  index->span_count = 0;
+  index->spans = NULL;
+  index->history_size = 0;
+  index->history = NULL;
+  index->packed_size = 0;
+  index->src_hash = 0;
+}
+
+static int compare_spans(const void* a, const void* b) {
+  uint32_t sa = ((const decode_span_t*)a)->start;
+  uint32_t sb = ((const decode_span_t*)b)->start;
+  return (sa < sb) ? -1 : ((sa > sb) ? 1 : 0);
+}
+
+static int push_span(decode_index_t* index, uint32_t* capacity, const decode_span_t* span) {
+  if (index->span_count == *capacity) {
+    uint32_t new_capacity = (*capacity == 0) ? 64 : (*capacity * 2);
+    decode_span_t* spans = (decode_span_t*)realloc(index->spans, new_capacity * sizeof(decode_span_t));
+
+    if (spans == NULL) {
+      return -1;
+    }
+
+    index->spans = spans;
+    *capacity = new_capacity;
+  }
+
+  index->spans[index->span_count++] = *span;
+  return 0;
+}
+
+static int finish_checkpoint(decode_index_t* index, decode_refs_t* refs, const uint8_t* out, uint32_t* span_capacity) {
+  decode_checkpoint_t* p = &index->points[index->count - 1];
+  uint32_t stride = index->word_mode ? 2 : 1;
+
+  if (refs->count > 1) {
+    qsort(refs->spans, refs->count, sizeof(decode_span_t), compare_spans);
+  }
+
+  p->first_span = index->span_count;
+  p->span_count = 0;
+
+  for (uint32_t i = 0; i < refs->count; ++i) {
+    const decode_span_t* ref = &refs->spans[i];
+
+    if (p->span_count != 0) {
+      decode_span_t* last = &index->spans[index->span_count - 1];
+
+      if (ref->start <= last->start + last->len) {
+        if (ref->start + ref->len > last->start + last->len) {
+          last->len = ref->start + ref->len - last->start;
+        }
+
+        continue;
+      }
+    }
+
+    if (push_span(index, span_capacity, ref) != 0) {
+      return -1;
+    }
+
+    p->span_count += 1;
+  }
+
+  uint32_t size = 0;
+
+  for (uint32_t i = 0; i < p->span_count; ++i) {
+    size += index->spans[p->first_span + i].len * stride;
+  }
+
+  uint8_t* history = (uint8_t*)realloc(index->history, index->history_size + size + 1);
+
+  if (history == NULL) {
+    return -1;
+  }
+
+  index->history = history;
+
+  for (uint32_t i = 0; i < p->span_count; ++i) {
+    decode_span_t* span = &index->spans[p->first_span + i];
+
+    span->offset = index->history_size;
+    memcpy(index->history + span->offset, out + span->start * stride, span->len * stride);
+    index->history_size += span->len * stride;
+  }
+
+  p->min_ref = (p->span_count != 0) ? index->spans[p->first_span].start : p->out_pos;
+  refs->count = 0;
+  return 0;
+}
+
+int build_decode_index(const uint8_t* src, uint32_t interval, decode_index_t* index) {
+  decoder_t d;
+
+  decoder_start(src, index, &d);
+
+  index->interval = (interval == 0) ? 1 : interval;
+
+  uint32_t stride = index->word_mode ? 2 : 1;
+  uint8_t* out = (uint8_t*)malloc(index->total_elems * stride + 1);
+
+  if (out == NULL) {
+    return -1;
+  }
+
+  decode_refs_t refs = { 0 };
+  uint32_t capacity = 0;
+  uint32_t span_capacity = 0;
+  uint32_t next = 0;
+  int woff = 0;
+  int r = 0;
+
+  while (r == 0 && d.left) {
+    if (d.out_pos >= next) {
+      if ((index->count != 0 && finish_checkpoint(index, &refs, out, &span_capacity) != 0) || push_checkpoint(index, &capacity, &d) != 0) {
+        r = -1;
+        break;
+      }
+
+      refs.limit = d.out_pos;
+      next = (d.out_pos / index->interval + 1) * index->interval;
+      d.pause_pos = next;
+    }
+
+    r = decode_group(src, index, &d, out, &woff, 0xFFFFFFFF, &refs);
+  }
+
+  if (r >= 0 && index->count != 0 && finish_checkpoint(index, &refs, out, &span_capacity) != 0) {
+    r = -1;
+  }
+
+  index->packed_size = d.data_off;
+  index->src_hash = hash_data(src, d.data_off);
+
+  free(refs.spans);
+  free(out);
+
+  if (r < 0) {
+    free_decode_index(index);
+    return -1;
+  }
+
+  return 0;
+}
+
+int get_compressed_size(const uint8_t* src) {
+  decode_index_t index;
+  decoder_t d;
+
+  decoder_start(src, &index, &d);
+
+  int r = 0;
+  while (r == 0 && d.left) {
+    r = decode_group(src, &index, &d, NULL, NULL, 0xFFFFFFFF, NULL);
+  }
+
+  return (r < 0) ? -1 : (int)d.data_off;
+}
+
+void free_decode_index(decode_index_t* index) {
+  free(index->history);
+  free(index->spans);
+  free(index->points);
+  index->history = NULL;
+  index->spans = NULL;
+  index->points = NULL;
+  index->history_size = 0;
+  index->span_count = 0;
+  index->count = 0;
+}
+
+static uint32_t find_checkpoint(const decode_index_t* index, uint32_t pos) {
+  uint32_t lo = 0;
+  uint32_t hi = index->count;
+
+  while (hi - lo > 1) {
+    uint32_t mid = lo + (hi - lo) / 2;
+
+    if (index->points[mid].out_pos <= pos) {
+      lo = mid;
+    }
+    else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+static void load_history(const decode_index_t* index, uint32_t point, uint8_t* window, uint32_t low) {
+  const decode_checkpoint_t* p = &index->points[point];
+  uint32_t stride = index->word_mode ? 2 : 1;
+
+  for (uint32_t i = 0; i < p->span_count; ++i) {
+    const decode_span_t* span = &index->spans[p->first_span + i];
+    memcpy(window + (span->start - low) * stride, index->history + span->offset, span->len * stride);
+  }
+}
+
+int decompress_range(const uint8_t* src, const decode_index_t* index, uint32_t start, uint32_t size, uint8_t* dst) {
+  decode_index_t stream;
+  decoder_t d;
+
+  decoder_start(src, &stream, &d);
+
+  const decode_index_t* info = (index != NULL) ? index : &stream;
+  uint32_t stride = info->word_mode ? 2 : 1;
+  uint32_t first = start / stride;
+  uint32_t last = (start + size + stride - 1) / stride;
+
+  if (size == 0) {
+    return 0;
+  }
+
+  if (last > info->total_elems || last <= first) {
+    return -1;
+  }
+
+  uint32_t s = 0;
+  uint32_t e = 0;
+  uint32_t low = 0;
+
+  if (index != NULL) {
+    if (index->count == 0) {
+      return -1;
+    }
+
+    s = find_checkpoint(index, first);
+    e = find_checkpoint(index, last - 1);
+    low = index->points[s].out_pos;
+
+    for (uint32_t i = s; i <= e; ++i) {
+      if (index->points[i].min_ref < low) {
+        low = index->points[i].min_ref;
+      }
+    }
+
+    const decode_checkpoint_t* p = &index->points[s];
+    d.roff = (int)p->roff;
+    d.bits = p->bits;
+    d.token = p->token;
+    d.data_off = p->data_off;
+    d.left = p->left;
+    d.unp_count = p->unp_count;
+    d.out_pos = p->out_pos;
+    d.pairs_left = p->pairs_left;
+  }
+
+  uint8_t* window = (uint8_t*)malloc((last - low) * stride);
+
+  if (window == NULL) {
+    return -1;
+  }
+
+  int woff = (int)((d.out_pos - low) * stride);
+  int r = 0;
+  uint32_t point = s;
+
+  while (r == 0 && d.out_pos < last) {
+    uint32_t stop = last;
+
+    if (index != NULL) {
+      load_history(index, point, window, low);
+
+      if (point < e) {
+        stop = index->points[point + 1].out_pos;
+      }
+
+      d.pause_pos = stop;
+      ++point;
+    }
+
+    while (r == 0 && d.out_pos < stop) {
+      r = decode_group(src, info, &d, window, &woff, last, NULL);
+    }
+  }
+
+  if (r < 0 || d.out_pos < last) {
+    free(window);
+    return -1;
+  }
+
+  memcpy(dst, window + (start - low * stride), size);
+  free(window);
+
+  return (int)size;
+}
+
+uint32_t decode_index_serialized_size(const decode_index_t* index) {
+  return 41 + index->count * 40 + index->span_count * 8 + index->history_size + 8;
+}
+
+static void write_dword(uint8_t* dst, int* offset, uint32_t value) {
+  write_word(dst, offset, (value >> 16) & 0xFFFF);
+  write_word(dst, offset, (value >> 0) & 0xFFFF);
+}
+
+int serialize_decode_index(const decode_index_t* index, uint8_t* dst) {
+  int woff = 0;
+
+  write_byte(dst, &woff, 'X');
+  write_byte(dst, &woff, 'I');
+  write_byte(dst, &woff, 'D');
+  write_byte(dst, &woff, '3');
+  write_byte(dst, &woff, index->word_mode ? 1 : 0);
+  write_word(dst, &woff, index->max_from);
+  write_word(dst, &woff, index->max_count);
+  write_dword(dst, &woff, index->interval);
+  write_dword(dst, &woff, index->total_elems);
+  write_dword(dst, &woff, index->count);
+  write_dword(dst, &woff, index->span_count);
+  write_dword(dst, &woff, index->history_size);
+  write_dword(dst, &woff, index->packed_size);
+  write_dword(dst, &woff, (uint32_t)(index->src_hash >> 32));
+  write_dword(dst, &woff, (uint32_t)(index->src_hash >> 0));
+
+  for (uint32_t i = 0; i < index->count; ++i) {
+    const decode_checkpoint_t* p = &index->points[i];
+
+    write_dword(dst, &woff, p->out_pos);
+    write_dword(dst, &woff, p->roff);
+    write_dword(dst, &woff, (uint32_t)p->bits);
+    write_dword(dst, &woff, p->token);
+    write_dword(dst, &woff, p->data_off);
+    write_dword(dst, &woff, p->left);
+    write_dword(dst, &woff, (uint32_t)p->unp_count);
+    write_dword(dst, &woff, p->pairs_left);
+    write_dword(dst, &woff, p->first_span);
+    write_dword(dst, &woff, p->span_count);
+  }
+
+  for (uint32_t i = 0; i < index->span_count; ++i) {
+    write_dword(dst, &woff, index->spans[i].start);
+    write_dword(dst, &woff, index->spans[i].len);
+  }
+
+  memcpy(dst + woff, index->history, index->history_size);
+  woff += (int)index->history_size;
+
+  uint64_t hash = hash_data(dst, (uint32_t)woff);
+  write_dword(dst, &woff, (uint32_t)(hash >> 32));
+  write_dword(dst, &woff, (uint32_t)(hash >> 0));
+
+  return woff;
+}
+
+static uint64_t read_hash(const uint8_t* src, int offset) {
+  uint64_t hi = read_dword(src, offset);
+  uint64_t lo = read_dword(src, offset + 4);
+  return (hi << 32) | lo;
+}
+
+static int check_checkpoints(const decode_index_t* index) {
+  int init = -1 - (index->word_mode ? 0 : 1);
+
+  for (uint32_t i = 0; i < index->count; ++i) {
+    const decode_checkpoint_t* p = &index->points[i];
+
+    if ((i == 0) ? (p->out_pos != 0) : (p->out_pos <= index->points[i - 1].out_pos)) {
+      return -1;
+    }
+
+    if (p->out_pos >= index->total_elems || p->left != index->total_elems - p->out_pos || p->unp_count != (int32_t)p->out_pos + init) {
+      return -1;
+    }
+
+    if (p->pairs_left > 0xFFFF || (p->pairs_left != 0 && i == 0) || p->bits < 0 || p->bits > 32 || p->roff < 16 || p->roff > p->data_off || p->data_off > index->packed_size) {
+      return -1;
+    }
+
+    if (p->first_span > index->span_count || p->span_count > index->span_count - p->first_span) {
+      return -1;
+    }
+
+    for (uint32_t k = 0; k < p->span_count; ++k) {
+      const decode_span_t* span = &index->spans[p->first_span + k];
+
+      if (span->len > p->out_pos || span->start > p->out_pos - span->len) {
+        return -1;
+      }
+    }
+  }
+
+  return 0;
+}
+
+int deserialize_decode_index(const uint8_t* data, uint32_t data_size, const uint8_t* src, uint32_t src_size, decode_index_t* index) {
+  if (data_size < 49 || memcmp(data, "XID3", 4) != 0 || src_size < 16) {
+    return -1;
+  }
+
+  if (read_hash(data, (int)data_size - 8) != hash_data(data, data_size - 8)) {
+    return -1;
+  }
+
+  decode_index_t stream;
+  decoder_t d;
+
+  decoder_start(src, &stream, &d);
+
+  int roff = 4;
+
+  index->word_mode = read_byte(data, roff); roff += 1;
+  index->max_from = read_word(data, roff); roff += 2;
+  index->max_count = read_word(data, roff); roff += 2;
+  index->interval = read_dword(data, roff); roff += 4;
+  index->total_elems = read_dword(data, roff); roff += 4;
+  index->count = read_dword(data, roff); roff += 4;
+  index->span_count = read_dword(data, roff); roff += 4;
+  index->history_size = read_dword(data, roff); roff += 4;
+  index->packed_size = read_dword(data, roff); roff += 4;
+  index->src_hash = read_hash(data, roff); roff += 8;
+  index->points = NULL;
+  index->spans = NULL;
+  index->history = NULL;
+
+  uint64_t expected = 41 + (uint64_t)index->count * 40 + (uint64_t)index->span_count * 8 + index->history_size + 8;
+
+  if (index->count == 0 || index->interval == 0 || expected != data_size) {
+    return -1;
+  }
+
+  if (index->word_mode != stream.word_mode || index->max_from != stream.max_from || index->max_count != stream.max_count ||
+      index->total_elems != stream.total_elems || index->packed_size > src_size || index->src_hash != hash_data(src, index->packed_size)) {
+    return -1;
+  }
+
+  uint32_t stride = index->word_mode ? 2 : 1;
+
+  index->points = (decode_checkpoint_t*)malloc(index->count * sizeof(decode_checkpoint_t));
+  index->spans = (decode_span_t*)malloc((index->span_count + 1) * sizeof(decode_span_t));
+  index->history = (uint8_t*)malloc(index->history_size + 1);
+
+  if (index->points == NULL || index->spans == NULL || index->history == NULL) {
+    free_decode_index(index);
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < index->count; ++i) {
+    decode_checkpoint_t* p = &index->points[i];
+
+    p->out_pos = read_dword(data, roff); roff += 4;
+    p->roff = read_dword(data, roff); roff += 4;
+    p->bits = (int32_t)read_dword(data, roff); roff += 4;
+    p->token = read_dword(data, roff); roff += 4;
+    p->data_off = read_dword(data, roff); roff += 4;
+    p->left = read_dword(data, roff); roff += 4;
+    p->unp_count = (int32_t)read_dword(data, roff); roff += 4;
+    p->pairs_left = read_dword(data, roff); roff += 4;
+    p->first_span = read_dword(data, roff); roff += 4;
+    p->span_count = read_dword(data, roff); roff += 4;
+  }
+
+  uint32_t offset = 0;
+
+  for (uint32_t i = 0; i < index->span_count; ++i) {
+    decode_span_t* span = &index->spans[i];
+
+    span->start = read_dword(data, roff); roff += 4;
+    span->len = read_dword(data, roff); roff += 4;
+    span->offset = offset;
+
+    if (span->len > (index->history_size - offset) / stride) {
+      free_decode_index(index);
+      return -1;
+    }
+
+    offset += span->len * stride;
+  }
+
+  if (offset != index->history_size || check_checkpoints(index) != 0) {
+    free_decode_index(index);
+    return -1;
+  }
+
+  memcpy(index->history, data + roff, index->history_size);
+
+  for (uint32_t i = 0; i < index->count; ++i) {
+    decode_checkpoint_t* p = &index->points[i];
+    p->min_ref = (p->span_count != 0) ? index->spans[p->first_span].start : p->out_pos;
+  }
+
+  return 0;
+}
+
+typedef struct safe_reader_t {
+  const uint8_t* src;
+  uint32_t src_cap;
+  uint32_t roff;
+  uint32_t token;
+  int bits;
+} safe_reader_t;
+
+static int safe_getbit(safe_reader_t* r) {
+  r->bits -= 1;
+
+  if (r->bits < 0) {
+    if (r->roff > r->src_cap - 4) {
+      return DECODE_ERR_SRC_OVERRUN;
+    }
+
+    r->token = read_dword(r->src, r->roff); r->roff += 4;
+    r->bits = 0x1F;
+  }
+
+  return (r->token & (1u << r->bits)) ? 1 : 0;
+}
+
+static int safe_getbits(safe_reader_t* r, int count, uint16_t* value) {
+  uint32_t result = 0;
+
+  for (int i = 0; i < count; ++i) {
+    int bit = safe_getbit(r);
+
+    if (bit < 0) {
+      return bit;
+    }
+
+    result = (result << 1) | bit;
+  }
+
+  *value = (uint16_t)result;
+  return 0;
+}
+
+static int safe_read_token(safe_reader_t* r, uint16_t value, uint16_t* result) {
+  const item_t* tbl = &table[table_row(value)];
+
+  if (tbl->index == 0) {
+    return safe_getbits(r, tbl->items[0].w2, result);
+  }
+
+  uint16_t v1 = 0;
+  uint16_t extra = 0;
+  int err = safe_getbits(r, tbl->index, &v1);
+
+  if (err < 0) {
+    return err;
+  }
+
+  if (v1 < masks[tbl->index]) {
+    err = safe_getbits(r, tbl->items[v1].w2, &extra);
+    *result = tbl->items[v1 + 1].w0 + extra;
+    return err;
+  }
+
+  return safe_getbits(r, tbl->items[v1].w2, result);
+}
+
+static int safe_read_count(safe_reader_t* r, uint16_t* value) {
+  *value = 0;
+
+  while (1) {
+    int bit = safe_getbit(r);
+
+    if (bit < 0) {
+      return bit;
+    }
+
+    if (bit) {
+      return 0;
+    }
+
+    *value += 1;
+  }
+}
+
+static void copy_match(uint8_t* dst, uint32_t woff, uint32_t dist, uint32_t size) {
+  uint8_t* d = dst + woff;
+  const uint8_t* s = d - dist;
+
+  if (dist >= 8) {
+    for (uint32_t i = 0; i < size; i += 8) {
+      memcpy(d + i, s + i, 8);
+    }
+  }
+  else {
+    for (uint32_t i = 0; i < size; ++i) {
+      d[i] = s[i];
+    }
+  }
+}
+
+int decompress_safe(const uint8_t* src, uint32_t src_cap, uint8_t* dst, uint32_t dst_cap, uint32_t* src_size) {
+  if (src == NULL || dst == NULL || src_cap < 16) {
+    return DECODE_ERR_HEADER;
+  }
+
+  uint32_t left = read_dword(src, 0);
+  uint32_t data_off = read_dword(src, 4);
+
+  if (data_off > src_cap - 8) {
+    return DECODE_ERR_SRC_OVERRUN;
+  }
+
+  data_off += 8;
+
+  uint16_t max_from = read_word(src, 8);
+  uint16_t max_count = read_word(src, 10);
+
+  safe_reader_t r;
+  r.src = src;
+  r.src_cap = src_cap;
+  r.roff = 12;
+  r.token = 0;
+  r.bits = 0;
+
+  int word_mode = safe_getbit(&r);
+
+  if (word_mode < 0) {
+    return word_mode;
+  }
+
+  uint32_t stride = word_mode ? 2 : 1;
+  left >>= word_mode ? 1 : 0;
+
+  if (dst_cap < decompress_slack || left > (dst_cap - decompress_slack) / stride) {
+    return DECODE_ERR_DST_CAPACITY;
+  }
+
+  int unp_count = -1 - (word_mode ? 0 : 1);
+  uint32_t woff = 0;
+
+  while (left) {
+    uint16_t count = 0;
+    int err = safe_read_count(&r, &count);
+
+    if (err < 0) {
+      return err;
+    }
+
+    count += 1;
+
+    if (count > left) {
+      return DECODE_ERR_COUNT_OVERFLOW;
+    }
+
+    left -= count;
+    unp_count += count;
+
+    uint32_t size = count * stride;
+
+    if (size > src_cap - data_off) {
+      return DECODE_ERR_LITERAL_OVERRUN;
+    }
+
+    memcpy(dst + woff, src + data_off, size);
+    woff += size;
+    data_off += size;
+
+    if (left == 0) {
+      break;
+    }
+
+    uint16_t pairs = 0;
+    err = safe_read_count(&r, &pairs);
+
+    if (err < 0) {
+      return err;
+    }
+
+    pairs += 1;
+
+    for (uint16_t i = 0; i < pairs; ++i) {
+      uint16_t token_val = max_from;
+
+      if (max_from >= unp_count) {
+        token_val = unp_count;
+      }
+
+      uint16_t from = 0;
+      err = safe_read_token(&r, token_val, &from);
+
+      if (err < 0) {
+        return err;
+      }
+
+      token_val = max_count;
+
+      if (max_count >= from) {
+        token_val = from;
+      }
+
+      err = safe_read_token(&r, token_val, &count);
+
+      if (err < 0) {
+        return err;
+      }
+
+      count += 1 + (word_mode ? 0 : 1);
+
+      if (count > left) {
+        return DECODE_ERR_COUNT_OVERFLOW;
+      }
+
+      left -= count;
+      unp_count += count;
+
+      uint32_t dist = 2 + from * stride;
+
+      if (dist > woff) {
+        return DECODE_ERR_BAD_REFERENCE;
+      }
+
+      size = count * stride;
+      copy_match(dst, woff, dist, size);
+      woff += size;
+    }
+  }
+
+  *src_size = data_off;
+
+  return (int)woff;
+}
+
+typedef struct m68k_costs_t {
+  uint32_t setup;
+  uint32_t fetch;
+  uint32_t bit;
+  uint32_t count_read;
+  uint32_t token_read;
+  uint32_t table_step;
+  uint32_t literal_run;
+  uint32_t literal_elem;
+  uint32_t pair;
+  uint32_t match_elem;
+} m68k_costs_t;
+
+static const m68k_costs_t m68k_costs = {
+  200, /* header reads, register setup */
+  26,  /* move.l (a0)+,d7 + counter reload */
+  24,  /* add.l d7,d7 + dbf + bcc */
+  16,  /* unary count loop entry/exit */
+  50,  /* read_token call, limit compare */
+  26,  /* cmp.w + bcc + lea per table row */
+  30,  /* literal run setup */
+  22,  /* move.b/w (a3)+,(a1)+ + dbf */
+  60,  /* from/count limits, source address */
+  22,  /* move.b/w (a4)+,(a1)+ + dbf */
+};
+
+int profile_decompress(const uint8_t* src, decode_profile_t* profile) {
+  decode_index_t stream;
+  decoder_t d;
+
+  memset(profile, 0, sizeof(*profile));
+  decoder_start(src, &stream, &d);
+  d.profile = profile;
+
+  int r = 0;
+
+  while (r == 0 && d.left) {
+    r = decode_group(src, &stream, &d, NULL, NULL, 0xFFFFFFFF, NULL);
+  }
+
+  if (r < 0) {
+    return -1;
+  }
+
+  profile->word_mode = stream.word_mode;
+  profile->out_size = stream.total_elems * (stream.word_mode ? 2 : 1);
+  profile->packed_size = d.data_off;
+  profile->fetches = (uint32_t)(d.roff - 12) / 4;
+  profile->bits = (uint32_t)(d.roff - 16) * 8 + (uint32_t)(0x20 - d.bits);
+  profile->cycles = m68k_costs.setup
+    + (uint64_t)profile->fetches * m68k_costs.fetch
+    + (uint64_t)profile->bits * m68k_costs.bit
+    + (uint64_t)profile->count_reads * m68k_costs.count_read
+    + (uint64_t)profile->token_reads * m68k_costs.token_read
+    + (uint64_t)profile->table_steps * m68k_costs.table_step
+    + (uint64_t)profile->literal_runs * m68k_costs.literal_run
+    + (uint64_t)profile->literal_elems * m68k_costs.literal_elem
+    + (uint64_t)profile->pairs * m68k_costs.pair
+    + (uint64_t)profile->match_elems * m68k_costs.match_elem;
+
+  return 0;
+}
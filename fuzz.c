@@ -0,0 +1,114 @@
+#include "main.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint32_t next_random(uint32_t* state) {
+  uint32_t x = *state;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  *state = x;
+  return x;
+}
+
+static void mutate(uint8_t* data, uint32_t size, uint32_t* cap, uint32_t* state) {
+  uint32_t edits = 1 + next_random(state) % 4;
+
+  for (uint32_t i = 0; i < edits; ++i) {
+    uint32_t pos = next_random(state) % size;
+
+    switch (next_random(state) % 4) {
+    case 0:
+      data[pos] ^= (uint8_t)(1u << (next_random(state) % 8));
+      break;
+    case 1:
+      data[pos] = (uint8_t)next_random(state);
+      break;
+    case 2:
+      data[pos % 12] = (uint8_t)next_random(state);
+      break;
+    default:
+      *cap = pos;
+      break;
+    }
+  }
+}
+
+int fuzz_decompress(const uint8_t* src, uint32_t src_size, uint32_t iterations) {
+  if (src_size < 16) {
+    printf("Wrong source binary data!\n");
+    return -1;
+  }
+
+  uint32_t out_size = (uint32_t)get_decompressed_size(src);
+  uint32_t dst_cap = out_size + decompress_slack;
+
+  uint8_t* dst = (uint8_t*)malloc(dst_cap);
+  uint8_t* ref = (uint8_t*)malloc(dst_cap);
+
+  if (dst == NULL || ref == NULL) {
+    free(ref);
+    free(dst);
+    printf("Cannot allocate destination data memory!\n");
+    return -1;
+  }
+
+  uint32_t packed_size = 0;
+  uint32_t ref_size = 0;
+  int size = decompress_safe(src, src_size, dst, dst_cap, &packed_size);
+
+  if (size < 0 || decompress(src, ref, &ref_size) != size || ref_size != packed_size || memcmp(dst, ref, size) != 0) {
+    free(ref);
+    free(dst);
+    printf("Safe decoder disagrees with reference on source data! Status: %d\n", size);
+    return -1;
+  }
+
+  uint8_t* data = (uint8_t*)malloc(packed_size);
+
+  if (data == NULL) {
+    free(ref);
+    free(dst);
+    printf("Cannot allocate source data memory!\n");
+    return -1;
+  }
+
+  uint32_t state = 0x2545F491;
+  uint32_t accepted = 0;
+  uint32_t mismatches = 0;
+  uint32_t rejected[7] = { 0 };
+
+  for (uint32_t i = 0; i < iterations; ++i) {
+    uint32_t cap = packed_size;
+
+    memcpy(data, src, packed_size);
+    mutate(data, packed_size, &cap, &state);
+
+    uint32_t used = 0;
+    size = decompress_safe(data, cap, dst, dst_cap, &used);
+
+    if (size < 0) {
+      rejected[-size] += 1;
+      continue;
+    }
+
+    accepted += 1;
+
+    if (decompress(data, ref, &ref_size) != size || ref_size != used || memcmp(dst, ref, size) != 0) {
+      mismatches += 1;
+      printf("Mismatch at iteration %u\n", i);
+    }
+  }
+
+  printf("Fuzz runs: %u, accepted: %u, mismatches: %u\n", iterations, accepted, mismatches);
+  printf("Rejected: header %u, src overrun %u, literal overrun %u, dst capacity %u, count overflow %u, bad reference %u\n",
+    rejected[-DECODE_ERR_HEADER], rejected[-DECODE_ERR_SRC_OVERRUN], rejected[-DECODE_ERR_LITERAL_OVERRUN],
+    rejected[-DECODE_ERR_DST_CAPACITY], rejected[-DECODE_ERR_COUNT_OVERFLOW], rejected[-DECODE_ERR_BAD_REFERENCE]);
+
+  free(data);
+  free(ref);
+  free(dst);
+  return (mismatches == 0) ? 0 : -1;
+}
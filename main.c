@@ -11,7 +11,273 @@ static void print_info() {
 
 static void print_help() {
   printf("Usage (unpack): xperts_cmp <source.bin> <dest.bin> d [hex_offset]\n");
-  printf("Usage   (pack): xperts_cmp <source.bin> <dest.bin> c\n\n");
+  printf("Usage   (pack): xperts_cmp <source.bin> <dest.bin> c [hex_budget]\n");
+  printf("Usage (stream): xperts_cmp <source.bin> <dest.bin> s [w]\n");
+  printf("Usage (parallel): xperts_cmp <source.bin> <dest.bin> j [hex_threads] [r]\n");
+  printf("Usage (repack): xperts_cmp <source.bin> <dest.bin> i <old_source.bin>\n");
+  printf("Usage  (index): xperts_cmp <source.bin> <dest.idx> x [hex_offset] [hex_interval]\n");
+  printf("                (checkpoints fall between literal runs and pairs, so one long run widens its gap)\n");
+  printf("Usage  (range): xperts_cmp <source.bin> <dest.bin> r <hex_offset> <hex_start> <hex_size> [source.idx]\n");
+  printf("Usage (estimate): xperts_cmp <source.bin> - e\n");
+  printf("Usage   (fuzz): xperts_cmp <source.bin> - f [hex_offset] [hex_iterations]\n");
+  printf("Usage (decode time): xperts_cmp <source.bin> - t [hex_offset]\n");
+  printf("Usage (batch unpack): xperts_cmp <rom.bin> <out_dir> u <offsets.txt>\n");
+  printf("Usage (batch repack): xperts_cmp <in_dir> <out_dir> p <offsets.txt>\n");
+  printf("Usage (batch decode time): xperts_cmp <rom.bin> - m <offsets.txt>\n\n");
+}
+
+static int write_parse_file(const char* path, const parse_t* parse) {
+  uint8_t* data = (uint8_t*)malloc(parse_serialized_size(parse));
+
+  if (data == NULL) {
+    return -1;
+  }
+
+  int size = serialize_parse(parse, data);
+  int r = write_file(path, data, size);
+
+  free(data);
+  return r;
+}
+
+static int write_index_file(const char* path, const uint8_t* src_data, uint32_t src_size, uint32_t interval) {
+  decode_index_t index;
+
+  if (src_size < 16) {
+    printf("Wrong source binary data! Cannot build decode index!\n");
+    return -1;
+  }
+
+  uint32_t size = get_decompressed_size(src_data);
+  uint8_t* check = (uint8_t*)malloc(size + decompress_slack);
+
+  if (check == NULL) {
+    printf("Cannot allocate destination data memory!\n");
+    return -1;
+  }
+
+  uint32_t packed_size = 0;
+  int status = decompress_safe(src_data, src_size, check, size + decompress_slack, &packed_size);
+  free(check);
+
+  if (status < 0 || build_decode_index(src_data, interval, &index) != 0) {
+    printf("Wrong source binary data! Cannot build decode index!\n");
+    return -1;
+  }
+
+  uint8_t* data = (uint8_t*)malloc(decode_index_serialized_size(&index));
+
+  if (data == NULL) {
+    free_decode_index(&index);
+    printf("Cannot allocate index memory!\n");
+    return -1;
+  }
+
+  uint32_t spacing = 0;
+
+  for (uint32_t i = 0; i < index.count; ++i) {
+    uint32_t end = (i + 1 < index.count) ? index.points[i + 1].out_pos : index.total_elems;
+
+    if (end - index.points[i].out_pos > spacing) {
+      spacing = end - index.points[i].out_pos;
+    }
+  }
+
+  int r = write_file(path, data, serialize_decode_index(&index, data));
+
+  if (r != 0) {
+    printf("Cannot open destination file!\n");
+  }
+  else {
+    printf("Decode index: %u checkpoints every %u elements (widest gap %u), 0x%X bytes of history\n", index.count, index.interval, spacing, index.history_size);
+  }
+
+  free(data);
+  free_decode_index(&index);
+  return r;
+}
+
+static int extract_range(const char* index_path, const uint8_t* src_data, uint32_t src_size, uint32_t start, uint32_t size, uint8_t* dst_data) {
+  decode_index_t index;
+  int r = -1;
+
+  if (index_path != NULL) {
+    uint32_t index_size = 0;
+    uint8_t* index_data = read_file(index_path, &index_size);
+
+    if (index_data != NULL) {
+      r = deserialize_decode_index(index_data, index_size, src_data, src_size, &index);
+      free(index_data);
+    }
+
+    if (r != 0) {
+      printf("Cannot read decode index or it does not match source data: %s\n", index_path);
+      return -1;
+    }
+  }
+  else {
+    return decompress_range(src_data, NULL, start, size, dst_data);
+  }
+
+  r = decompress_range(src_data, &index, start, size, dst_data);
+  free_decode_index(&index);
+  return r;
+}
+
+static int repack(const char* dest_path, const char* old_path, const uint8_t* src_data, uint32_t src_size, uint8_t* dst_data) {
+  char parse_path[1024];
+  snprintf(parse_path, sizeof(parse_path), "%s.parse", dest_path);
+
+  uint32_t old_size = 0;
+  uint32_t parse_size = 0;
+  uint8_t* old_data = read_file(old_path, &old_size);
+  uint8_t* parse_data = read_file(parse_path, &parse_size);
+
+  parse_t old_parse;
+  parse_t parse;
+  init_parse(&parse, 0, 0, 0, 0);
+
+  int dst_size = -1;
+
+  if (old_data != NULL && parse_data != NULL && deserialize_parse(parse_data, parse_size, &old_parse) == 0) {
+    if (old_parse.src_hash == hash_data(old_data, old_size)) {
+      dst_size = compress_incremental(old_data, old_size, &old_parse, src_data, src_size, dst_data, &parse);
+      printf("Reused previous parse: %s\n", parse_path);
+    }
+    else {
+      dst_size = compress_with_parse(src_data, src_size, dst_data, &parse);
+      printf("Previous parse does not match old source, full compression.\n");
+    }
+
+    free_parse(&old_parse);
+  }
+  else {
+    dst_size = compress_with_parse(src_data, src_size, dst_data, &parse);
+    printf("No previous parse found, full compression.\n");
+  }
+
+  free(parse_data);
+  free(old_data);
+
+  if (dst_size >= 0 && write_parse_file(parse_path, &parse) != 0) {
+    printf("Cannot write parse file!\n");
+  }
+
+  free_parse(&parse);
+  return dst_size;
+}
+
+static int print_estimates(const uint8_t* src_data, uint32_t src_size) {
+  for (int word_mode = 0; word_mode < 2; ++word_mode) {
+    size_estimate_t estimate;
+
+    if (word_mode != 0 && (src_size % 2) != 0) {
+      printf("Word mode: not available for odd sizes\n");
+      continue;
+    }
+
+    if (estimate_compressed_size(src_data, src_size, word_mode, &estimate) != 0) {
+      printf("Cannot estimate compressed size!\n");
+      return -1;
+    }
+
+    printf("%s mode: ~%u +/- %u bytes (%s %u of %u elements, heuristic bound)\n", word_mode ? "Word" : "Byte", estimate.size, estimate.error,
+      (estimate.parsed < estimate.total) ? "sampled" : "parsed", estimate.parsed, estimate.total);
+  }
+
+  return 0;
+}
+
+static int print_decode_time(const uint8_t* src_data, uint32_t src_size) {
+  if (src_size < 16) {
+    printf("Wrong source binary data!\n");
+    return -1;
+  }
+
+  uint32_t size = get_decompressed_size(src_data);
+  uint8_t* data = (uint8_t*)malloc(size + decompress_slack);
+
+  if (data == NULL) {
+    printf("Cannot allocate destination data memory!\n");
+    return -1;
+  }
+
+  uint32_t packed_size = 0;
+  int r = decompress_safe(src_data, src_size, data, size + decompress_slack, &packed_size);
+  free(data);
+
+  decode_profile_t profile;
+
+  if (r < 0 || profile_decompress(src_data, &profile) != 0) {
+    printf("Wrong source binary data (status %d)!\n", r);
+    return -1;
+  }
+
+  profile.packed_size = packed_size;
+
+  printf("%s mode: 0x%X -> 0x%X bytes\n", profile.word_mode ? "Word" : "Byte", profile.packed_size, profile.out_size);
+  printf("Token fetches: %u, bits: %u, counts: %u, tokens: %u (table steps: %u)\n",
+    profile.fetches, profile.bits, profile.count_reads, profile.token_reads, profile.table_steps);
+  printf("Literal runs: %u (%u elements), pairs: %u (%u elements)\n",
+    profile.literal_runs, profile.literal_elems, profile.pairs, profile.match_elems);
+  printf("68000 cycles: ~%llu (%.2f ms, %.2f frames at 60 Hz)\n", (unsigned long long)profile.cycles,
+    profile.cycles * 1000.0 / m68k_clock_hz, profile.cycles * 60.0 / m68k_clock_hz);
+  return 0;
+}
+
+static void print_parallel_loss(const uint8_t* src_data, uint32_t src_size, uint32_t parallel_size) {
+  uint8_t* seq_data = (uint8_t*)malloc(max_compressed_size(src_size));
+
+  if (seq_data == NULL) {
+    printf("Cannot allocate destination data memory!\n");
+    return;
+  }
+
+  int size = compress_with_parse(src_data, src_size, seq_data, NULL);
+  free(seq_data);
+
+  if (size < 0) {
+    printf("Cannot compress source data sequentially!\n");
+    return;
+  }
+
+  uint32_t seq_size = (uint32_t)size;
+
+  printf("Sequential: 0x%X bytes, parallel: 0x%X bytes, loss: %d bytes (%.3f%%)\n", seq_size, parallel_size,
+    (int)(parallel_size - seq_size), (seq_size == 0) ? 0.0 : ((double)parallel_size - seq_size) * 100.0 / seq_size);
+}
+
+static int stream_pack(const char* src_path, const char* dst_path, int word_mode) {
+  FILE* f = fopen(src_path, "rb");
+
+  if (f == NULL) {
+    printf("Cannot open source file!\n");
+    return -1;
+  }
+
+  FILE* w = fopen(dst_path, "wb");
+
+  if (w == NULL) {
+    fclose(f);
+    printf("Cannot open destination file!\n");
+    return -1;
+  }
+
+  int dst_size = compress_stream(f, w, word_mode);
+  long src_size = ftell(f);
+
+  fclose(w);
+  fclose(f);
+
+  if (dst_size < 0) {
+    remove(dst_path);
+    printf("Cannot compress source data!\n");
+    return -1;
+  }
+
+  printf("Successfully compressed!\n");
+  printf("Original size / Result size: %ld/%d\n", src_size, dst_size);
+  return 0;
 }
 
 int main(int argc, char* argv[]) {
@@ -25,16 +291,37 @@ int main(int argc, char* argv[]) {
   int mode = argv[3][0];
   uint32_t offset = 0;
 
-  if (mode != 'd' && mode != 'c') {
-    printf("Incorrect usage mode. Valid are: [d, c]. Passed: %c\n", mode & 0xFF);
+  if (mode != 'd' && mode != 'c' && mode != 's' && mode != 'i' && mode != 'x' && mode != 'r' && mode != 'e' && mode != 'f' && mode != 'u' && mode != 'p' && mode != 't' && mode != 'm' && mode != 'j') {
+    printf("Incorrect usage mode. Valid are: [d, c, s, i, x, r, e, f, u, p, t, m, j]. Passed: %c\n", mode & 0xFF);
     print_help();
     return -1;
   }
 
-  if (mode == 'd' && argc > 4) {
+  if ((mode == 'd' || mode == 'x' || mode == 'r' || mode == 'f' || mode == 't') && argc > 4) {
     offset = (uint32_t)strtol(argv[4], NULL, 16);
   }
 
+  if (((mode == 'i' || mode == 'u' || mode == 'p' || mode == 'm') && argc < 5) || (mode == 'r' && argc < 7)) {
+    print_help();
+    return -1;
+  }
+
+  if (mode == 's') {
+    return stream_pack(argv[1], argv[2], argc > 4 && argv[4][0] == 'w');
+  }
+
+  if (mode == 'u') {
+    return batch_unpack(argv[1], argv[2], argv[4]);
+  }
+
+  if (mode == 'p') {
+    return batch_repack(argv[1], argv[2], argv[4]);
+  }
+
+  if (mode == 'm') {
+    return batch_decode_time(argv[1], argv[4]);
+  }
+
   FILE* f = fopen(argv[1], "rb");
 
   if (f == NULL) {
@@ -63,9 +350,48 @@ int main(int argc, char* argv[]) {
 
   fclose(f);
 
+  if (mode == 'e') {
+    int r = print_estimates(src_data, src_size);
+
+    free(src_data);
+    return r;
+  }
+
+  if (mode == 't') {
+    int r = print_decode_time(src_data, src_size);
+
+    free(src_data);
+    return r;
+  }
+
+  if (mode == 'f') {
+    uint32_t iterations = (argc > 5) ? (uint32_t)strtol(argv[5], NULL, 16) : 0x10000;
+    int r = fuzz_decompress(src_data, src_size, iterations);
+
+    free(src_data);
+    return r;
+  }
+
+  if (mode == 'x') {
+    uint32_t interval = (argc > 5) ? (uint32_t)strtol(argv[5], NULL, 16) : 0x1000;
+    int r = write_index_file(argv[2], src_data, src_size, interval);
+
+    free(src_data);
+    return r;
+  }
+
   uint32_t dst_size = 0;
 
-  if (mode == 'd') {
+  if (mode == 'r') {
+    dst_size = (uint32_t)strtol(argv[6], NULL, 16);
+
+    if (dst_size == 0) {
+      free(src_data);
+      printf("Range size is 0!\n");
+      return -1;
+    }
+  }
+  else if (mode == 'd') {
     dst_size = get_decompressed_size(src_data);
 
     if (dst_size == 0) {
@@ -91,6 +417,73 @@ int main(int argc, char* argv[]) {
 
     printf("Successfully decompressed!\n");
   }
+  else if (mode == 'r') {
+    uint32_t start = (uint32_t)strtol(argv[5], NULL, 16);
+
+    if (extract_range((argc > 7) ? argv[7] : NULL, src_data, src_size, start, dst_size, dst_data) < 0) {
+      free(dst_data);
+      free(src_data);
+      printf("Cannot decompress requested range!\n");
+      return -1;
+    }
+
+    printf("Successfully decompressed!\n");
+  }
+  else if (mode == 'i') {
+    int size = repack(argv[2], argv[4], src_data, src_size, dst_data);
+
+    if (size < 0) {
+      free(dst_data);
+      free(src_data);
+      printf("Cannot compress source data!\n");
+      return -1;
+    }
+
+    dst_size = size;
+
+    printf("Successfully compressed!\n");
+  }
+  else if (mode == 'j') {
+    int threads = (argc > 4) ? (int)strtol(argv[4], NULL, 16) : 0;
+    int size = compress_parallel(src_data, src_size, dst_data, threads);
+
+    if (size < 0) {
+      free(dst_data);
+      free(src_data);
+      printf("Cannot compress source data!\n");
+      return -1;
+    }
+
+    dst_size = size;
+
+    if (argc > 5 && argv[5][0] == 'r') {
+      print_parallel_loss(src_data, src_size, dst_size);
+    }
+
+    printf("Successfully compressed!\n");
+  }
+  else if (argc > 4) {
+    uint32_t budget = (uint32_t)strtol(argv[4], NULL, 16);
+    int size = compress_with_budget(src_data, src_size, dst_data, budget, NULL);
+
+    if (size == COMPRESS_ERR_OVER_BUDGET) {
+      free(dst_data);
+      free(src_data);
+      printf("Compressed data does not fit into 0x%X bytes!\n", budget);
+      return -2;
+    }
+
+    if (size < 0) {
+      free(dst_data);
+      free(src_data);
+      printf("Cannot compress source data!\n");
+      return -1;
+    }
+
+    dst_size = size;
+
+    printf("Successfully compressed!\n");
+  }
   else {
     dst_size = compress(src_data, src_size, dst_data);
 
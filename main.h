@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <stdio.h>
 
 static const uint16_t masks[] = {
   0x0000, 0x0001, 0x0003, 0x0007, 0x000F, 0x001F, 0x003F, 0x007F, 0x00FF,
@@ -36,8 +37,133 @@ static const item_t table[] = {
 };
 
 
+typedef struct parse_token_t {
+  uint32_t len;
+  uint16_t from;
+  uint8_t is_pair;
+} parse_token_t;
+
+typedef struct parse_t {
+  int word_mode;
+  uint16_t max_from;
+  uint16_t max_count;
+  uint32_t total_elems;
+  uint64_t src_hash;
+  uint32_t count;
+  uint32_t capacity;
+  parse_token_t* tokens;
+} parse_t;
+
+uint64_t hash_data(const uint8_t* data, uint32_t size);
+void init_parse(parse_t* parse, int word_mode, uint16_t max_from, uint16_t max_count, uint32_t total_elems);
+void free_parse(parse_t* parse);
+uint32_t parse_serialized_size(const parse_t* parse);
+int serialize_parse(const parse_t* parse, uint8_t* dst);
+int deserialize_parse(const uint8_t* src, uint32_t src_size, parse_t* parse);
+
+enum {
+  COMPRESS_ERR_FAILED = -1,
+  COMPRESS_ERR_OVER_BUDGET = -2,
+};
+
+typedef struct size_estimate_t {
+  int word_mode;
+  uint32_t size;
+  uint32_t error;
+  uint32_t parsed;
+  uint32_t total;
+} size_estimate_t;
+
 uint32_t max_compressed_size(uint32_t src_size);
 int compress(const uint8_t* src, uint32_t src_size, uint8_t* dst);
+int compress_with_budget(const uint8_t* src, uint32_t src_size, uint8_t* dst, uint32_t budget, parse_t* parse);
+int compress_with_parse(const uint8_t* src, uint32_t src_size, uint8_t* dst, parse_t* parse);
+int compress_incremental(const uint8_t* old_src, uint32_t old_size, const parse_t* old_parse, const uint8_t* src, uint32_t src_size, uint8_t* dst, parse_t* parse);
+int compress_stream(FILE* in, FILE* out, int word_mode);
+int compress_parallel(const uint8_t* src, uint32_t src_size, uint8_t* dst, int threads);
+int estimate_compressed_size(const uint8_t* src, uint32_t src_size, int word_mode, size_estimate_t* estimate);
+
+typedef struct decode_checkpoint_t {
+  uint32_t out_pos;
+  uint32_t roff;
+  int32_t bits;
+  uint32_t token;
+  uint32_t data_off;
+  uint32_t left;
+  int32_t unp_count;
+  uint32_t pairs_left;
+  uint32_t min_ref;
+  uint32_t first_span;
+  uint32_t span_count;
+} decode_checkpoint_t;
+
+typedef struct decode_span_t {
+  uint32_t start;
+  uint32_t len;
+  uint32_t offset;
+} decode_span_t;
+
+typedef struct decode_index_t {
+  int word_mode;
+  uint16_t max_from;
+  uint16_t max_count;
+  uint32_t interval;
+  uint32_t total_elems;
+  uint32_t count;
+  decode_checkpoint_t* points;
+  uint32_t span_count;
+  decode_span_t* spans;
+  uint32_t history_size;
+  uint8_t* history;
+  uint32_t packed_size;
+  uint64_t src_hash;
+} decode_index_t;
+
+enum {
+  DECODE_ERR_HEADER = -1,
+  DECODE_ERR_SRC_OVERRUN = -2,
+  DECODE_ERR_LITERAL_OVERRUN = -3,
+  DECODE_ERR_DST_CAPACITY = -4,
+  DECODE_ERR_COUNT_OVERFLOW = -5,
+  DECODE_ERR_BAD_REFERENCE = -6,
+};
+
+static const uint32_t decompress_slack = 16;
+
+typedef struct decode_profile_t {
+  int word_mode;
+  uint32_t out_size;
+  uint32_t packed_size;
+  uint32_t fetches;
+  uint32_t bits;
+  uint32_t count_reads;
+  uint32_t token_reads;
+  uint32_t table_steps;
+  uint32_t literal_runs;
+  uint32_t literal_elems;
+  uint32_t pairs;
+  uint32_t match_elems;
+  uint64_t cycles;
+} decode_profile_t;
+
+static const uint32_t m68k_clock_hz = 7670454;
 
 int decompress(const uint8_t* src, uint8_t* dst, uint32_t* src_size);
+int decompress_safe(const uint8_t* src, uint32_t src_cap, uint8_t* dst, uint32_t dst_cap, uint32_t* src_size);
 int get_decompressed_size(const uint8_t* src);
+int get_compressed_size(const uint8_t* src);
+
+int build_decode_index(const uint8_t* src, uint32_t interval, decode_index_t* index);
+void free_decode_index(decode_index_t* index);
+uint32_t decode_index_serialized_size(const decode_index_t* index);
+int serialize_decode_index(const decode_index_t* index, uint8_t* dst);
+int deserialize_decode_index(const uint8_t* data, uint32_t data_size, const uint8_t* src, uint32_t src_size, decode_index_t* index);
+int profile_decompress(const uint8_t* src, decode_profile_t* profile);
+int decompress_range(const uint8_t* src, const decode_index_t* index, uint32_t start, uint32_t size, uint8_t* dst);
+
+uint8_t* read_file(const char* path, uint32_t* size);
+int write_file(const char* path, const uint8_t* data, uint32_t size);
+int batch_unpack(const char* rom_path, const char* out_dir, const char* list_path);
+int batch_repack(const char* in_dir, const char* out_dir, const char* list_path);
+int batch_decode_time(const char* rom_path, const char* list_path);
+int fuzz_decompress(const uint8_t* src, uint32_t src_size, uint32_t iterations);
@@ -0,0 +1,150 @@
+#include "main.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+static const uint8_t parse_magic[4] = { 'X', 'P', 'R', '2' };
+
+static void write_byte(uint8_t* dst, int* offset, uint8_t value) {
+  dst[*offset] = value;
+  *offset += 1;
+}
+
+static void write_word_be(uint8_t* dst, int* offset, uint16_t value) {
+  write_byte(dst, offset, (uint8_t)((value >> 8) & 0xFF));
+  write_byte(dst, offset, (uint8_t)((value >> 0) & 0xFF));
+}
+
+static void write_dword_be(uint8_t* dst, int* offset, uint32_t value) {
+  write_word_be(dst, offset, (uint16_t)((value >> 16) & 0xFFFF));
+  write_word_be(dst, offset, (uint16_t)((value >> 0) & 0xFFFF));
+}
+
+static uint8_t read_byte(const uint8_t* src, int* offset) {
+  uint8_t value = src[*offset];
+  *offset += 1;
+  return value;
+}
+
+static uint16_t read_word_be(const uint8_t* src, int* offset) {
+  uint16_t b1 = read_byte(src, offset);
+  uint16_t b2 = read_byte(src, offset);
+  return (uint16_t)((b1 << 8) | (b2 << 0));
+}
+
+static uint32_t read_dword_be(const uint8_t* src, int* offset) {
+  uint32_t w1 = read_word_be(src, offset);
+  uint32_t w2 = read_word_be(src, offset);
+  return (w1 << 16) | (w2 << 0);
+}
+
+uint64_t hash_data(const uint8_t* data, uint32_t size) {
+  uint64_t hash = 0xCBF29CE484222325ull;
+
+  for (uint32_t i = 0u; i < size; ++i) {
+    hash ^= data[i];
+    hash *= 0x100000001B3ull;
+  }
+
+  return hash;
+}
+
+void init_parse(parse_t* parse, int word_mode, uint16_t max_from, uint16_t max_count, uint32_t total_elems) {
+  parse->word_mode = word_mode;
+  parse->max_from = max_from;
+  parse->max_count = max_count;
+  parse->total_elems = total_elems;
+  parse->src_hash = 0u;
+  parse->count = 0u;
+  parse->capacity = 0u;
+  parse->tokens = NULL;
+}
+
+void free_parse(parse_t* parse) {
+  free(parse->tokens);
+  parse->tokens = NULL;
+  parse->count = 0u;
+  parse->capacity = 0u;
+}
+
+uint32_t parse_serialized_size(const parse_t* parse) {
+  return 25u + parse->count * 7u;
+}
+
+int serialize_parse(const parse_t* parse, uint8_t* dst) {
+  int woff = 0;
+
+  for (int i = 0; i < 4; ++i) {
+    write_byte(dst, &woff, parse_magic[i]);
+  }
+
+  write_byte(dst, &woff, (uint8_t)((parse->word_mode != 0) ? 1 : 0));
+  write_word_be(dst, &woff, parse->max_from);
+  write_word_be(dst, &woff, parse->max_count);
+  write_dword_be(dst, &woff, parse->total_elems);
+  write_dword_be(dst, &woff, (uint32_t)(parse->src_hash >> 32));
+  write_dword_be(dst, &woff, (uint32_t)(parse->src_hash >> 0));
+  write_dword_be(dst, &woff, parse->count);
+
+  for (uint32_t i = 0u; i < parse->count; ++i) {
+    write_byte(dst, &woff, parse->tokens[i].is_pair);
+    write_word_be(dst, &woff, parse->tokens[i].from);
+    write_dword_be(dst, &woff, parse->tokens[i].len);
+  }
+
+  return woff;
+}
+
+int deserialize_parse(const uint8_t* src, uint32_t src_size, parse_t* parse) {
+  if (src_size < 25u || memcmp(src, parse_magic, 4) != 0) {
+    return -1;
+  }
+
+  int roff = 4;
+
+  int word_mode = read_byte(src, &roff);
+  uint16_t max_from = read_word_be(src, &roff);
+  uint16_t max_count = read_word_be(src, &roff);
+  uint32_t total_elems = read_dword_be(src, &roff);
+  uint64_t src_hash = read_dword_be(src, &roff);
+  src_hash = (src_hash << 32) | read_dword_be(src, &roff);
+  uint32_t count = read_dword_be(src, &roff);
+
+  if (count > (src_size - 25u) / 7u) {
+    return -1;
+  }
+
+  init_parse(parse, word_mode, max_from, max_count, total_elems);
+  parse->src_hash = src_hash;
+
+  parse->tokens = (parse_token_t*)malloc(((count == 0u) ? 1u : count) * sizeof(parse_token_t));
+  if (parse->tokens == NULL) {
+    return -1;
+  }
+
+  parse->capacity = (count == 0u) ? 1u : count;
+
+  uint32_t sum = 0u;
+  for (uint32_t i = 0u; i < count; ++i) {
+    parse_token_t* t = &parse->tokens[i];
+    t->is_pair = read_byte(src, &roff);
+    t->from = read_word_be(src, &roff);
+    t->len = read_dword_be(src, &roff);
+
+    if (t->len == 0u || t->len > total_elems - sum) {
+      free_parse(parse);
+      return -1;
+    }
+
+    sum += t->len;
+  }
+
+  parse->count = count;
+
+  if (sum != total_elems) {
+    free_parse(parse);
+    return -1;
+  }
+
+  return 0;
+}